@@ -77,7 +77,7 @@ WIFI_QUAL_TOPIC  = b"xdm1041/wifiquality"   # quality in % (integer string)
 PATTERN_SOFT_START = b"\x00\x01\x00"
 
 # ─── Code timestamp (update each edit) ────────────────────────────────────────────
-CODE_TIMESTAMP = "2025-08-11 17:36:00 (Europe/Berlin)"
+CODE_TIMESTAMP = "2026-10-17 10:00:00 (Europe/Berlin)"
 
 # ─── Global state ─────────────────────────────────────────────────────────────────
 device_offline        = False
@@ -244,7 +244,9 @@ def run_sequence():
           SLOW_BLINK_ON_S if (ready and rate_ok) else FAST_BLINK_ON_S,
           SLOW_BLINK_OFF_S if (ready and rate_ok) else FAST_BLINK_OFF_S)
     device_offline = False
-    mqtt_client.publish(STATUS_TOPIC, b"online", retain=True)
+    # Runs before WiFi; setup_mqtt() publishes the status once the broker is reached
+    if mqtt_client is not None:
+        mqtt_client.publish(STATUS_TOPIC, b"online", retain=True)
     log('RUN', 'Startup done ready={} rate_ok={}'.format(ready, rate_ok))
 
 
@@ -315,9 +317,11 @@ if __name__ == '__main__':
     log('SYS', 'Author: Elektroarzt')
     log('SYS', '----------------------------------------')
 
+    # Meter first: the WiFi portal can block for minutes and the meter should be in
+    # fast sampling by the time anyone asks for readings
+    run_sequence()
     setup_wifi()
     setup_mqtt()
-    run_sequence()
 
     uart_soft = init_uart(); buffer = b''; last_heartbeat = time.time()
 
@@ -1,9 +1,16 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import uart, sensor, text_sensor
+from esphome import pins
+from esphome.components import uart, sensor, text_sensor, time
+import esphome.final_validate as fv
+from esphome.core import CORE, ID
 from esphome.const import (
+    CONF_FORMAT,
     CONF_ID,
+    CONF_TIME_ID,
+    CONF_TOPIC,
     CONF_MODEL,
+    CONF_PIN,
     CONF_TEMPERATURE,
     DEVICE_CLASS_VOLTAGE,
     DEVICE_CLASS_CURRENT,
@@ -17,13 +24,88 @@ from esphome.const import (
     UNIT_FARAD,
 )
 
+DOMAIN = "scpi_dmm"
 DEPENDENCIES = ['uart']
 AUTO_LOAD = ['sensor', 'text_sensor']
+MULTI_CONF = True
 
 CONF_VALUE = "value"
 CONF_FUNCTION = "function"
 CONF_IDN = "idn"
 CONF_DEVICE_TYPE = "device_type"
+CONF_SOURCE = "source"
+CONF_QUERY_INTERVAL = "query_interval"
+CONF_RX_EVENTS = "rx_events"
+CONF_SAMPLE_CLOCK = "sample_clock"
+CONF_TRIGGER_INPUT = "trigger_input"
+CONF_STATUS = "status"
+CONF_WATCHDOG = "watchdog"
+CONF_PROBE_MIN_INTERVAL = "probe_min_interval"
+CONF_PROBE_MAX_INTERVAL = "probe_max_interval"
+CONF_BAUD = "baud"
+CONF_RATES = "rates"
+CONF_AUTODETECT = "autodetect"
+CONF_NEGOTIATE = "negotiate"
+CONF_BAUD_COMMAND = "command"
+CONF_VERIFY_COUNT = "verify_count"
+CONF_TRIGGER_OUTPUT = "trigger_output"
+CONF_EDGE = "edge"
+CONF_PULSE_LENGTH = "pulse_length"
+CONF_SEQUENCE = "sequence"
+CONF_SEQUENCE_RESULT = "sequence_result"
+CONF_SEQUENCE_AUTOSTART = "sequence_autostart"
+CONF_RANGE = "range"
+CONF_SETTLE_TIME = "settle_time"
+CONF_SKIP = "skip"
+CONF_READINGS = "readings"
+CONF_SETTLE_TOLERANCE = "settle_tolerance"
+CONF_SETTLE_TIMEOUT = "settle_timeout"
+CONF_DISCARD_AFTER_SWITCH = "discard_after_switch"
+CONF_WRITE_COALESCE = "write_coalesce"
+CONF_STATE_POLL_INTERVAL = "state_poll_interval"
+CONF_SCHEDULER = "scheduler"
+CONF_INTERACTIVE_RATE = "interactive_rate"
+CONF_CONFIGURATION_RATE = "configuration_rate"
+CONF_MEASUREMENT_RATE = "measurement_rate"
+CONF_HOUSEKEEPING_RATE = "housekeeping_rate"
+CONF_HOUSEKEEPING_SHARE = "housekeeping_share"
+CONF_INTERACTIVE_LATENCY_BUDGET = "interactive_latency_budget"
+CONF_MQTT_BRIDGE = "mqtt_bridge"
+CONF_COMMAND_TOPIC = "command_topic"
+CONF_RESPONSE_TOPIC = "response_topic"
+CONF_STATUS_TOPIC = "status_topic"
+CONF_OFFLINE_AFTER = "offline_after"
+CONF_MQTT_STREAM = "mqtt_stream"
+CONF_OUTBOX = "outbox"
+CONF_REPLAY_INTERVAL = "replay_interval"
+CONF_SPOOL_PATH = "spool_path"
+CONF_SPOOL_MAX_SIZE = "spool_max_size"
+CONF_BATCH_SIZE = "batch_size"
+CONF_BATCH_INTERVAL = "batch_interval"
+CONF_HISTORY = "history"
+CONF_MEMORY_SIZE = "memory_size"
+CONF_HTTP = "http"
+CONF_LIVE_STREAM = "live_stream"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_MAX_BATCH = "max_batch"
+CONF_MAX_CLIENTS = "max_clients"
+CONF_BUFFERED = "buffered"
+CONF_BUFFER_FETCH_INTERVAL = "buffer_fetch_interval"
+CONF_DATALOG = "datalog"
+CONF_PATH = "path"
+CONF_MAX_SIZE = "max_size"
+CONF_FLUSH_INTERVAL = "flush_interval"
+CONF_DERIVED = "derived"
+CONF_OPERATION = "operation"
+CONF_A = "a"
+CONF_B = "b"
+CONF_MAX_SKEW = "max_skew"
+CONF_OUTPUT_SOURCE = "output_source"
+CONF_CALIBRATION = "calibration"
+CONF_GAIN = "gain"
+CONF_OFFSET = "offset"
+CONF_POLYNOMIAL = "polynomial"
+CONF_TABLE = "table"
 
 # Supported device types
 DEVICE_TYPES = {
@@ -38,10 +120,238 @@ DEVICE_TYPES = {
 # Create namespace for our component
 scpi_dmm_ns = cg.esphome_ns.namespace('scpi_dmm')
 SCPIDMM = scpi_dmm_ns.class_('SCPIDMM', cg.Component, uart.UARTDevice)
+CommandPriority = scpi_dmm_ns.enum("CommandPriority", is_class=True)
+StreamFormat = scpi_dmm_ns.enum("StreamFormat", is_class=True)
+SamplePipeline = scpi_dmm_ns.class_("SamplePipeline")
+DerivedChannel = scpi_dmm_ns.class_("DerivedChannel", sensor.Sensor)
+DerivedOperation = scpi_dmm_ns.enum("DerivedOperation", is_class=True)
+ChannelInput = scpi_dmm_ns.struct("ChannelInput")
+MeasurementFunction = scpi_dmm_ns.enum("MeasurementFunction", is_class=True)
 
-CONFIG_SCHEMA = cv.Schema({
+gpio_ns = cg.esphome_ns.namespace("gpio")
+TRIGGER_EDGES = {
+    "rising": gpio_ns.INTERRUPT_RISING_EDGE,
+    "falling": gpio_ns.INTERRUPT_FALLING_EDGE,
+    "any": gpio_ns.INTERRUPT_ANY_EDGE,
+}
+
+STREAM_FORMATS = {
+    "json": StreamFormat.JSON,
+    "binary": StreamFormat.BINARY,
+}
+
+# Commands per second for each scheduling class, 0 = unlimited
+SCHEDULER_RATES = {
+    CONF_INTERACTIVE_RATE: CommandPriority.INTERACTIVE,
+    CONF_CONFIGURATION_RATE: CommandPriority.CONFIGURATION,
+    CONF_MEASUREMENT_RATE: CommandPriority.MEASUREMENT,
+    CONF_HOUSEKEEPING_RATE: CommandPriority.HOUSEKEEPING,
+}
+
+DERIVED_OPERATIONS = {
+    "multiply": DerivedOperation.MULTIPLY,
+    "divide": DerivedOperation.DIVIDE,
+    "efficiency": DerivedOperation.EFFICIENCY,
+}
+
+MEASUREMENT_FUNCTIONS = {
+    "VOLT:DC": MeasurementFunction.VOLTAGE_DC,
+    "VOLT:AC": MeasurementFunction.VOLTAGE_AC,
+    "CURR:DC": MeasurementFunction.CURRENT_DC,
+    "CURR:AC": MeasurementFunction.CURRENT_AC,
+    "RES": MeasurementFunction.RESISTANCE,
+    "FREQ": MeasurementFunction.FREQUENCY,
+    "TEMP": MeasurementFunction.TEMPERATURE,
+    "CAP": MeasurementFunction.CAPACITANCE,
+}
+
+# Input filters for derived channels, "any" accepts every function of the source
+INPUT_FUNCTIONS = {
+    "any": MeasurementFunction.UNKNOWN,
+    **MEASUREMENT_FUNCTIONS,
+    "DERIVED": MeasurementFunction.DERIVED,
+}
+
+SCHEDULER_SCHEMA = cv.Schema({
+    cv.Optional(CONF_INTERACTIVE_RATE, default=0): cv.positive_float,
+    cv.Optional(CONF_CONFIGURATION_RATE, default=0): cv.positive_float,
+    cv.Optional(CONF_MEASUREMENT_RATE, default=0): cv.positive_float,
+    cv.Optional(CONF_HOUSEKEEPING_RATE, default=5): cv.positive_float,
+    cv.Optional(CONF_HOUSEKEEPING_SHARE, default=8): cv.int_range(min=0, max=255),
+    cv.Optional(CONF_INTERACTIVE_LATENCY_BUDGET, default="250ms"): cv.positive_time_period_milliseconds,
+})
+
+WATCHDOG_SCHEMA = cv.Schema({
+    cv.Optional(CONF_OFFLINE_AFTER, default=3): cv.int_range(min=1, max=255),
+    cv.Optional(CONF_PROBE_MIN_INTERVAL, default="250ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_PROBE_MAX_INTERVAL, default="30s"): cv.positive_time_period_milliseconds,
+})
+
+BAUD_SCHEMA = cv.Schema({
+    cv.Optional(CONF_RATES, default=[115200, 57600, 38400, 19200, 9600]): cv.All(
+        cv.ensure_list(cv.int_range(min=300, max=5000000)), cv.Length(min=1)
+    ),
+    cv.Optional(CONF_AUTODETECT, default=True): cv.boolean,
+    cv.Optional(CONF_NEGOTIATE, default=True): cv.boolean,
+    cv.Optional(CONF_BAUD_COMMAND): cv.string,
+    cv.Optional(CONF_VERIFY_COUNT, default=10): cv.int_range(min=1, max=100),
+})
+
+def validate_sequence_step(config):
+    if not config[CONF_FUNCTION] and not config[CONF_RANGE]:
+        raise cv.Invalid("Sequence steps need a function or range command")
+    return config
+
+
+SEQUENCE_STEP_SCHEMA = cv.All(cv.Schema({
+    cv.Optional(CONF_FUNCTION, default=""): cv.string,
+    cv.Optional(CONF_RANGE, default=""): cv.string,
+    cv.Optional(CONF_SETTLE_TIME, default="0ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_SKIP, default=0): cv.int_range(min=0, max=255),
+    cv.Optional(CONF_READINGS, default=1): cv.int_range(min=1, max=255),
+}), validate_sequence_step)
+
+MQTT_BRIDGE_SCHEMA = cv.All(cv.Schema({
+    # Topics default to <mqtt topic_prefix>/dmm[<source>]/cmd, /resp and /status
+    cv.Optional(CONF_COMMAND_TOPIC): cv.publish_topic,
+    cv.Optional(CONF_RESPONSE_TOPIC): cv.publish_topic,
+    cv.Optional(CONF_STATUS_TOPIC): cv.publish_topic,
+    cv.Optional(CONF_OFFLINE_AFTER): cv.invalid(
+        f"The bridge follows the link watchdog; set {CONF_OFFLINE_AFTER} under '{CONF_WATCHDOG}'"
+    ),
+}), cv.requires_component("mqtt"))
+
+OUTBOX_SCHEMA = cv.Schema({
+    cv.Optional(CONF_MEMORY_SIZE, default=16384): cv.int_range(min=0, max=262144),
+    cv.Optional(CONF_REPLAY_INTERVAL, default="100ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_SPOOL_PATH): cv.All(cv.only_with_arduino, cv.string_strict),
+    cv.Optional(CONF_SPOOL_MAX_SIZE, default=262144): cv.int_range(min=8192),
+})
+
+MQTT_STREAM_SCHEMA = cv.All(cv.Schema({
+    # Defaults to <mqtt topic_prefix>/dmm[<source>]/samples
+    cv.Optional(CONF_TOPIC): cv.publish_topic,
+    cv.Optional(CONF_FORMAT, default="json"): cv.enum(STREAM_FORMATS, lower=True),
+    cv.Optional(CONF_BATCH_SIZE, default=50): cv.int_range(min=1, max=1000),
+    cv.Optional(CONF_BATCH_INTERVAL, default="1s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_OUTBOX, default={}): OUTBOX_SCHEMA,
+}), cv.requires_component("mqtt"))
+
+def validate_http(value):
+    value = cv.boolean(value)
+    if value:
+        cv.requires_component("web_server_base")(value)
+    return value
+
+
+HISTORY_SCHEMA = cv.Schema({
+    cv.Optional(CONF_MEMORY_SIZE, default=32768): cv.int_range(min=2048, max=1048576),
+})
+
+LIVE_STREAM_SCHEMA = cv.All(cv.Schema({
+    cv.Optional(CONF_BUFFER_SIZE, default=512): cv.int_range(min=16, max=8192),
+    cv.Optional(CONF_MAX_BATCH, default=100): cv.int_range(min=1, max=1000),
+    cv.Optional(CONF_MAX_CLIENTS, default=2): cv.int_range(min=1, max=8),
+}), cv.only_with_arduino)
+
+
+DATALOG_SCHEMA = cv.All(cv.Schema({
+    cv.Optional(CONF_PATH, default="/scpi_dmm.log"): cv.string_strict,
+    cv.Optional(CONF_MAX_SIZE, default=262144): cv.int_range(min=8192),
+    cv.Optional(CONF_FLUSH_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+}), cv.only_with_arduino)
+
+
+DERIVED_INPUT_SCHEMA = cv.Schema({
+    cv.Required(CONF_SOURCE): cv.int_range(min=0, max=255),
+    cv.Optional(CONF_FUNCTION, default="any"): cv.enum(INPUT_FUNCTIONS),
+})
+
+
+def validate_derived(config):
+    if CONF_OUTPUT_SOURCE in config:
+        for key in (CONF_A, CONF_B):
+            if config[key][CONF_SOURCE] == config[CONF_OUTPUT_SOURCE]:
+                raise cv.Invalid(f"Input '{key}' reads the channel's own {CONF_OUTPUT_SOURCE}")
+    return config
+
+
+DERIVED_SCHEMA = cv.All(sensor.sensor_schema(
+    DerivedChannel,
+    accuracy_decimals=4,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend({
+    cv.Required(CONF_OPERATION): cv.enum(DERIVED_OPERATIONS, lower=True),
+    cv.Required(CONF_A): DERIVED_INPUT_SCHEMA,
+    cv.Required(CONF_B): DERIVED_INPUT_SCHEMA,
+    cv.Optional(CONF_MAX_SKEW, default="500ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_OUTPUT_SOURCE): cv.int_range(min=16, max=255),
+}), validate_derived)
+
+
+def validate_calibration(config):
+    kinds = [key for key in (CONF_POLYNOMIAL, CONF_TABLE) if key in config]
+    if CONF_GAIN in config or CONF_OFFSET in config:
+        kinds.append(CONF_GAIN)
+    if len(kinds) != 1:
+        raise cv.Invalid(f"Give exactly one of {CONF_GAIN}/{CONF_OFFSET}, {CONF_POLYNOMIAL} or {CONF_TABLE}")
+    table = config.get(CONF_TABLE)
+    if table is not None and any(b[0] <= a[0] for a, b in zip(table, table[1:])):
+        raise cv.Invalid("Calibration table raw values must be strictly increasing")
+    return config
+
+
+def calibration_point(value):
+    value = cv.ensure_list(cv.float_)(value)
+    if len(value) != 2:
+        raise cv.Invalid("Table points are [raw, calibrated] pairs")
+    return value
+
+
+CALIBRATION_SCHEMA = cv.All(cv.Schema({
+    cv.Required(CONF_FUNCTION): cv.enum(MEASUREMENT_FUNCTIONS, upper=True),
+    cv.Optional(CONF_RANGE, default=""): cv.string,
+    cv.Optional(CONF_GAIN): cv.float_,
+    cv.Optional(CONF_OFFSET): cv.float_,
+    cv.Optional(CONF_POLYNOMIAL): cv.All(cv.ensure_list(cv.float_), cv.Length(min=1, max=8)),
+    cv.Optional(CONF_TABLE): cv.All(cv.ensure_list(calibration_point), cv.Length(min=2, max=64)),
+}), validate_calibration)
+
+
+TRIGGER_INPUT_SCHEMA = cv.Schema({
+    cv.Required(CONF_PIN): pins.internal_gpio_input_pin_schema,
+    cv.Optional(CONF_EDGE, default="rising"): cv.enum(TRIGGER_EDGES, lower=True),
+})
+
+TRIGGER_OUTPUT_SCHEMA = cv.Schema({
+    cv.Required(CONF_PIN): pins.gpio_output_pin_schema,
+    cv.Optional(CONF_PULSE_LENGTH, default="100us"): cv.All(
+        cv.positive_time_period_microseconds, cv.Range(max=cv.TimePeriod(milliseconds=1))
+    ),
+})
+
+
+def validate_acquisition(config):
+    if CONF_TRIGGER_INPUT in config and config[CONF_SAMPLE_CLOCK]:
+        raise cv.Invalid(f"Readings are paced either by {CONF_TRIGGER_INPUT} or by {CONF_SAMPLE_CLOCK}, not both")
+    return config
+
+
+def validate_http_routes(config):
+    if CONF_LIVE_STREAM in config and not config[CONF_HTTP]:
+        raise cv.Invalid(f"{CONF_LIVE_STREAM} is served over HTTP and requires '{CONF_HTTP}: true'")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(cv.Schema({
     cv.GenerateID(): cv.declare_id(SCPIDMM),
     cv.Optional(CONF_DEVICE_TYPE, default="auto"): cv.enum(DEVICE_TYPES),
+    cv.Optional(CONF_SOURCE, default=0): cv.int_range(min=0, max=15),
+    cv.Optional(CONF_QUERY_INTERVAL, default="100ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_RX_EVENTS, default=True): cv.boolean,
+    cv.Optional(CONF_SAMPLE_CLOCK, default=False): cv.boolean,
+    cv.Optional(CONF_TRIGGER_INPUT): TRIGGER_INPUT_SCHEMA,
+    cv.Optional(CONF_TRIGGER_OUTPUT): TRIGGER_OUTPUT_SCHEMA,
     cv.Optional(CONF_VALUE): sensor.sensor_schema(
         accuracy_decimals=6,
         device_class=DEVICE_CLASS_VOLTAGE,
@@ -49,4 +359,265 @@ CONFIG_SCHEMA = cv.Schema({
     ),
     cv.Optional(CONF_FUNCTION): text_sensor.text_sensor_schema(),
     cv.Optional(CONF_IDN): text_sensor.text_sensor_schema(),
-}).extend(cv.COMPONENT_SCHEMA).extend(uart.UART_DEVICE_SCHEMA)
+    cv.Optional(CONF_STATUS): text_sensor.text_sensor_schema(),
+    cv.Optional(CONF_WATCHDOG, default={}): WATCHDOG_SCHEMA,
+    cv.Optional(CONF_BAUD): BAUD_SCHEMA,
+    cv.Optional(CONF_SCHEDULER, default={}): SCHEDULER_SCHEMA,
+    cv.Optional(CONF_WRITE_COALESCE, default="100ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_STATE_POLL_INTERVAL, default="10s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_BUFFERED, default=True): cv.boolean,
+    cv.Optional(CONF_BUFFER_FETCH_INTERVAL, default="200ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_SETTLE_TOLERANCE, default="1%"): cv.percentage,
+    cv.Optional(CONF_SETTLE_TIMEOUT, default="3s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_DISCARD_AFTER_SWITCH, default=1): cv.int_range(min=0, max=255),
+    cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
+    cv.Optional(CONF_MQTT_BRIDGE): MQTT_BRIDGE_SCHEMA,
+    cv.Optional(CONF_MQTT_STREAM): MQTT_STREAM_SCHEMA,
+    cv.Optional(CONF_HISTORY): HISTORY_SCHEMA,
+    cv.Optional(CONF_LIVE_STREAM): LIVE_STREAM_SCHEMA,
+    cv.Optional(CONF_DATALOG): DATALOG_SCHEMA,
+    cv.Optional(CONF_HTTP, default=False): validate_http,
+    cv.Optional(CONF_DERIVED): cv.ensure_list(DERIVED_SCHEMA),
+    cv.Optional(CONF_CALIBRATION): cv.ensure_list(CALIBRATION_SCHEMA),
+    cv.Optional(CONF_SEQUENCE): cv.ensure_list(SEQUENCE_STEP_SCHEMA),
+    cv.Optional(CONF_SEQUENCE_AUTOSTART, default=True): cv.boolean,
+    cv.Optional(CONF_SEQUENCE_RESULT): text_sensor.text_sensor_schema(),
+}).extend(cv.COMPONENT_SCHEMA).extend(uart.UART_DEVICE_SCHEMA), validate_http_routes, validate_acquisition)
+
+
+def _final_validate(config):
+    blocks = fv.full_config.get().get(DOMAIN, [])
+    sources = [conf[CONF_SOURCE] for conf in blocks]
+    if sources.count(config[CONF_SOURCE]) > 1:
+        raise cv.Invalid(
+            f"Several {DOMAIN} blocks use source {config[CONF_SOURCE]}, give each meter its own '{CONF_SOURCE}'"
+        )
+    outputs = [
+        derived[CONF_OUTPUT_SOURCE]
+        for conf in blocks
+        for derived in conf.get(CONF_DERIVED, [])
+        if CONF_OUTPUT_SOURCE in derived
+    ]
+    for derived in config.get(CONF_DERIVED, []):
+        if CONF_OUTPUT_SOURCE in derived and outputs.count(derived[CONF_OUTPUT_SOURCE]) > 1:
+            raise cv.Invalid(f"Several derived channels use {CONF_OUTPUT_SOURCE} {derived[CONF_OUTPUT_SOURCE]}")
+    own = {derived[CONF_OUTPUT_SOURCE] for derived in config.get(CONF_DERIVED, []) if CONF_OUTPUT_SOURCE in derived}
+    cycle = _derived_cycle(blocks)
+    # Reported once, by the block that owns the first channel on the loop
+    if cycle and cycle[0] in own:
+        raise cv.Invalid(
+            "Derived channels feed each other in a loop: " + " -> ".join(f"source {source}" for source in cycle)
+        )
+    return config
+
+
+def _derived_cycle(blocks):
+    """Returns the output sources on the first loop among derived channels, or None."""
+    # Edges run from a channel's output_source to the output_sources it reads; DERIVED
+    # results carry their own function, so inputs filtered to anything else cannot close a loop
+    graph = {}
+    for conf in blocks:
+        for derived in conf.get(CONF_DERIVED, []):
+            if CONF_OUTPUT_SOURCE not in derived:
+                continue
+            graph[derived[CONF_OUTPUT_SOURCE]] = [
+                derived[key][CONF_SOURCE]
+                for key in (CONF_A, CONF_B)
+                if derived[key][CONF_FUNCTION] in ("any", "DERIVED")
+            ]
+    visiting = []
+    done = set()
+
+    def visit(node):
+        if node in visiting:
+            return visiting[visiting.index(node):] + [node]
+        if node in done or node not in graph:
+            return None
+        visiting.append(node)
+        for source in graph[node]:
+            cycle = visit(source)
+            if cycle:
+                return cycle
+        visiting.pop()
+        done.add(node)
+        return None
+
+    for node in sorted(graph):
+        cycle = visit(node)
+        if cycle:
+            return cycle
+    return None
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
+def _shared_pipeline():
+    # One pipeline for all meters on the node, created with the first block
+    data = CORE.data.setdefault(DOMAIN, {})
+    if "pipeline" not in data:
+        data["pipeline"] = cg.new_Pvariable(ID("scpi_dmm_pipeline", is_declaration=True, type=SamplePipeline))
+    return data["pipeline"]
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    await uart.register_uart_device(var, config)
+
+    # Before anything below subscribes to the pipeline
+    cg.add(var.set_pipeline(_shared_pipeline()))
+    cg.add(var.set_source(config[CONF_SOURCE]))
+    cg.add(var.set_query_interval(config[CONF_QUERY_INTERVAL].total_milliseconds))
+    cg.add(var.set_rx_events(config[CONF_RX_EVENTS]))
+    cg.add(var.set_sample_clock(config[CONF_SAMPLE_CLOCK]))
+    if CONF_TRIGGER_INPUT in config:
+        trigger = config[CONF_TRIGGER_INPUT]
+        pin = await cg.gpio_pin_expression(trigger[CONF_PIN])
+        cg.add(var.set_trigger_input(pin, trigger[CONF_EDGE]))
+    if CONF_TRIGGER_OUTPUT in config:
+        trigger = config[CONF_TRIGGER_OUTPUT]
+        pin = await cg.gpio_pin_expression(trigger[CONF_PIN])
+        cg.add(var.set_trigger_output(pin, trigger[CONF_PULSE_LENGTH].total_microseconds))
+
+    cg.add(var.set_device_type(config[CONF_DEVICE_TYPE]))
+    scheduler = config[CONF_SCHEDULER]
+    for key, priority in SCHEDULER_RATES.items():
+        cg.add(var.set_command_rate(priority, scheduler[key]))
+    cg.add(var.set_housekeeping_share(scheduler[CONF_HOUSEKEEPING_SHARE]))
+    cg.add(var.set_interactive_latency_budget(scheduler[CONF_INTERACTIVE_LATENCY_BUDGET].total_milliseconds))
+    cg.add(var.set_write_coalesce(config[CONF_WRITE_COALESCE].total_milliseconds))
+    cg.add(var.set_state_poll_interval(config[CONF_STATE_POLL_INTERVAL].total_milliseconds))
+    cg.add(var.set_buffered(config[CONF_BUFFERED]))
+    cg.add(var.set_buffer_fetch_interval(config[CONF_BUFFER_FETCH_INTERVAL].total_milliseconds))
+
+    if CONF_VALUE in config:
+        sens = await sensor.new_sensor(config[CONF_VALUE])
+        cg.add(var.set_value_sensor(sens))
+    if CONF_FUNCTION in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_FUNCTION])
+        cg.add(var.set_function_sensor(sens))
+    if CONF_IDN in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_IDN])
+        cg.add(var.set_idn_sensor(sens))
+    if CONF_STATUS in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_STATUS])
+        cg.add(var.set_status_sensor(sens))
+    watchdog = config[CONF_WATCHDOG]
+    cg.add(var.set_watchdog(
+        watchdog[CONF_OFFLINE_AFTER],
+        watchdog[CONF_PROBE_MIN_INTERVAL].total_milliseconds,
+        watchdog[CONF_PROBE_MAX_INTERVAL].total_milliseconds,
+    ))
+
+    if CONF_BAUD in config:
+        baud = config[CONF_BAUD]
+        cg.add(var.set_baud_rates(
+            baud[CONF_RATES],
+            baud[CONF_AUTODETECT],
+            baud[CONF_NEGOTIATE],
+            baud[CONF_VERIFY_COUNT],
+        ))
+        if CONF_BAUD_COMMAND in baud:
+            cg.add(var.set_baud_command(baud[CONF_BAUD_COMMAND]))
+
+    cg.add(var.set_settle_tolerance(config[CONF_SETTLE_TOLERANCE]))
+    cg.add(var.set_settle_timeout(config[CONF_SETTLE_TIMEOUT].total_milliseconds))
+    cg.add(var.set_switch_discard(config[CONF_DISCARD_AFTER_SWITCH]))
+
+    if CONF_MQTT_BRIDGE in config:
+        bridge = config[CONF_MQTT_BRIDGE]
+        cg.add(var.set_mqtt_bridge(
+            bridge.get(CONF_COMMAND_TOPIC, ""),
+            bridge.get(CONF_RESPONSE_TOPIC, ""),
+            bridge.get(CONF_STATUS_TOPIC, ""),
+        ))
+
+    if CONF_TIME_ID in config:
+        clock = await cg.get_variable(config[CONF_TIME_ID])
+        cg.add(var.set_time(clock))
+
+    if CONF_MQTT_STREAM in config:
+        stream = config[CONF_MQTT_STREAM]
+        cg.add(var.set_mqtt_stream(
+            stream.get(CONF_TOPIC, ""),
+            stream[CONF_FORMAT],
+            stream[CONF_BATCH_SIZE],
+            stream[CONF_BATCH_INTERVAL].total_milliseconds,
+        ))
+        outbox = stream[CONF_OUTBOX]
+        if outbox[CONF_MEMORY_SIZE] > 0:
+            cg.add(var.set_mqtt_outbox(outbox[CONF_MEMORY_SIZE], outbox[CONF_REPLAY_INTERVAL].total_milliseconds))
+            if CONF_SPOOL_PATH in outbox:
+                cg.add_define("USE_SCPI_DMM_SPOOL")
+                if CORE.is_esp32:
+                    cg.add_library("FS", None)
+                    cg.add_library("LittleFS", None)
+                cg.add(var.set_mqtt_spool(outbox[CONF_SPOOL_PATH], outbox[CONF_SPOOL_MAX_SIZE]))
+
+    if CONF_HISTORY in config:
+        cg.add(var.set_history(config[CONF_HISTORY][CONF_MEMORY_SIZE]))
+
+    if CONF_LIVE_STREAM in config:
+        live = config[CONF_LIVE_STREAM]
+        cg.add_define("USE_SCPI_DMM_LIVE_STREAM")
+        cg.add(var.set_live_stream(live[CONF_BUFFER_SIZE], live[CONF_MAX_BATCH], live[CONF_MAX_CLIENTS]))
+
+    if CONF_DATALOG in config:
+        datalog = config[CONF_DATALOG]
+        cg.add_define("USE_SCPI_DMM_DATALOG")
+        if CORE.is_esp32:
+            cg.add_library("FS", None)
+            cg.add_library("LittleFS", None)
+        cg.add(var.set_datalog(
+            datalog[CONF_PATH],
+            datalog[CONF_MAX_SIZE],
+            datalog[CONF_FLUSH_INTERVAL].total_milliseconds,
+        ))
+
+    if config[CONF_HTTP]:
+        cg.add_define("USE_SCPI_DMM_HTTP")
+
+    for calibration in config.get(CONF_CALIBRATION, []):
+        function = calibration[CONF_FUNCTION]
+        range_ = calibration[CONF_RANGE].upper()  # as the meter reports it
+        if CONF_POLYNOMIAL in calibration:
+            cg.add(var.add_polynomial_calibration(function, range_, calibration[CONF_POLYNOMIAL]))
+        elif CONF_TABLE in calibration:
+            table = calibration[CONF_TABLE]
+            cg.add(var.add_table_calibration(
+                function, range_, [point[0] for point in table], [point[1] for point in table]
+            ))
+        else:
+            cg.add(var.add_linear_calibration(
+                function, range_, calibration.get(CONF_GAIN, 1.0), calibration.get(CONF_OFFSET, 0.0)
+            ))
+
+    for derived in config.get(CONF_DERIVED, []):
+        inputs = [
+            cg.StructInitializer(
+                ChannelInput,
+                ("source", derived[key][CONF_SOURCE]),
+                ("function", derived[key][CONF_FUNCTION]),
+            )
+            for key in (CONF_A, CONF_B)
+        ]
+        sens = await sensor.new_sensor(
+            derived, derived[CONF_OPERATION], *inputs, derived[CONF_MAX_SKEW].total_milliseconds
+        )
+        if CONF_OUTPUT_SOURCE in derived:
+            cg.add(sens.set_output_source(derived[CONF_OUTPUT_SOURCE]))
+        cg.add(var.add_derived_channel(sens))
+
+    for step in config.get(CONF_SEQUENCE, []):
+        cg.add(var.add_sequence_step(
+            step[CONF_FUNCTION],
+            step[CONF_RANGE],
+            step[CONF_SETTLE_TIME].total_milliseconds,
+            step[CONF_SKIP],
+            step[CONF_READINGS],
+        ))
+    cg.add(var.set_sequence_autostart(config[CONF_SEQUENCE_AUTOSTART]))
+    if CONF_SEQUENCE_RESULT in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_SEQUENCE_RESULT])
+        cg.add(var.set_sequence_sensor(sens))
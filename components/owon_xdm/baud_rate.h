@@ -0,0 +1,75 @@
+#pragma once
+
+#include "esphome/components/uart/uart.h"
+#ifdef USE_ESP_IDF
+#include "esphome/components/uart/uart_component_esp_idf.h"
+#include <driver/uart.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Baud rates the meter can be set to, fastest first. Auto-detection cycles through all
+// of them; negotiation only tries rates that have not failed verification.
+class BaudRates {
+ public:
+  void set(std::vector<uint32_t> rates) {
+    std::sort(rates.begin(), rates.end(), std::greater<uint32_t>());
+    rates.erase(std::unique(rates.begin(), rates.end()), rates.end());
+    this->rates_ = std::move(rates);
+    this->failed_.assign(this->rates_.size(), false);
+  }
+
+  size_t size() const { return this->rates_.size(); }
+
+  // Rate to probe after current failed, wrapping from the slowest back to the fastest
+  uint32_t next_after(uint32_t current) const {
+    if (this->rates_.empty())
+      return current;
+    auto it = std::find(this->rates_.begin(), this->rates_.end(), current);
+    if (it == this->rates_.end() || ++it == this->rates_.end())
+      return this->rates_.front();
+    return *it;
+  }
+
+  // Fastest rate above current that has not failed, 0 if there is none
+  uint32_t faster_than(uint32_t current) const {
+    for (size_t i = 0; i < this->rates_.size() && this->rates_[i] > current; i++) {
+      if (!this->failed_[i])
+        return this->rates_[i];
+    }
+    return 0;
+  }
+
+  void mark_failed(uint32_t rate) {
+    auto it = std::find(this->rates_.begin(), this->rates_.end(), rate);
+    if (it != this->rates_.end())
+      this->failed_[it - this->rates_.begin()] = true;
+  }
+
+ protected:
+  std::vector<uint32_t> rates_;
+  std::vector<bool> failed_;
+};
+
+// Changes the UART rate in place, after what was written has gone out at the old one.
+// On ESP-IDF only the divider is reprogrammed: reloading the settings reinstalls the
+// driver, which would pull the event queue away from the RX task.
+inline void apply_uart_baud_rate(uart::UARTComponent *uart, uint32_t rate) {
+  uart->flush();
+  uart->set_baud_rate(rate);
+#ifdef USE_ESP_IDF
+  auto *idf = static_cast<uart::IDFUARTComponent *>(uart);
+  uart_set_baudrate(static_cast<uart_port_t>(idf->get_hw_serial_number()), rate);
+#else
+  uart->load_settings(false);
+#endif
+}
+
+}  // namespace scpi_dmm
+}  // namespace esphome
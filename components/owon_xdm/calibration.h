@@ -0,0 +1,112 @@
+#pragma once
+
+#include "sample_pipeline.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Maps a raw reading to a calibrated one. Built once from the configuration; apply()
+// is a multiply-add, a Horner loop or a binary search, cheap enough for every sample.
+class CalibrationTransform {
+ public:
+  // gain * x + offset
+  static CalibrationTransform linear(float gain, float offset) {
+    CalibrationTransform transform(Kind::LINEAR);
+    transform.points_ = {{gain, offset}};
+    return transform;
+  }
+
+  // c0 + c1 * x + c2 * x^2 + ...
+  static CalibrationTransform polynomial(const std::vector<float> &coefficients) {
+    CalibrationTransform transform(Kind::POLYNOMIAL);
+    // Stored highest order first for Horner's method
+    for (auto it = coefficients.rbegin(); it != coefficients.rend(); ++it)
+      transform.points_.emplace_back(*it, 0.0f);
+    return transform;
+  }
+
+  // Piecewise-linear through (raw[i], calibrated[i]); raw must be strictly increasing.
+  // Readings outside the table extend the first or last segment.
+  static CalibrationTransform table(const std::vector<float> &raw, const std::vector<float> &calibrated) {
+    CalibrationTransform transform(Kind::TABLE);
+    for (size_t i = 0; i < raw.size() && i < calibrated.size(); i++)
+      transform.points_.emplace_back(raw[i], calibrated[i]);
+    return transform;
+  }
+
+  float apply(float x) const {
+    switch (this->kind_) {
+      case Kind::LINEAR:
+        return this->points_[0].first * x + this->points_[0].second;
+      case Kind::POLYNOMIAL: {
+        float y = 0.0f;
+        for (const auto &point : this->points_)
+          y = y * x + point.first;
+        return y;
+      }
+      case Kind::TABLE: {
+        if (this->points_.size() < 2)
+          return x;
+        auto upper = std::upper_bound(this->points_.begin() + 1, this->points_.end() - 1, x,
+                                      [](float value, const std::pair<float, float> &point) { return value < point.first; });
+        const auto &p1 = *upper;
+        const auto &p0 = *(upper - 1);
+        return p0.second + (x - p0.first) * (p1.second - p0.second) / (p1.first - p0.first);
+      }
+    }
+    return x;
+  }
+
+ protected:
+  enum class Kind : uint8_t { LINEAR, POLYNOMIAL, TABLE };
+
+  explicit CalibrationTransform(Kind kind) : kind_(kind) {}
+
+  Kind kind_;
+  // LINEAR: {gain, offset}; POLYNOMIAL: coefficients in .first; TABLE: (raw, calibrated)
+  std::vector<std::pair<float, float>> points_;
+};
+
+// Calibrations per function, optionally narrowed to one range. A range-specific entry
+// wins over the function-wide one. select() is meant to run once per query or batch,
+// not per sample.
+class Calibration {
+ public:
+  void add(MeasurementFunction function, const std::string &range, CalibrationTransform transform) {
+    this->entries_.push_back(Entry{function, range, std::move(transform)});
+  }
+
+  // nullptr when readings pass through unchanged
+  const CalibrationTransform *select(MeasurementFunction function, const std::string &range) const {
+    const CalibrationTransform *fallback = nullptr;
+    for (const auto &entry : this->entries_) {
+      if (entry.function != function)
+        continue;
+      if (entry.range.empty()) {
+        fallback = &entry.transform;
+      } else if (entry.range == range) {
+        return &entry.transform;
+      }
+    }
+    return fallback;
+  }
+
+  bool empty() const { return this->entries_.empty(); }
+
+ protected:
+  struct Entry {
+    MeasurementFunction function;
+    std::string range;  // empty for every range
+    CalibrationTransform transform;
+  };
+
+  std::vector<Entry> entries_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// What the in-flight query is expected to answer
+enum class ResponseKind : uint8_t {
+  NONE,
+  MEASUREMENT,
+  FUNCTION,
+  RANGE,
+  AUTO_RANGE,
+  RATE,
+  READING_LIST,  // Comma-separated list or definite-length block, parsed as it arrives
+  RAW            // Passed unparsed to the command's callback
+};
+
+// Scheduling classes, highest priority first
+enum class CommandPriority : uint8_t {
+  INTERACTIVE = 0,  // services, MQTT and other user-issued commands
+  CONFIGURATION,    // function/range switches and init sequences
+  MEASUREMENT,      // periodic and sequenced readings
+  HOUSEKEEPING      // state cache validation and other background queries
+};
+
+static const size_t PRIORITY_COUNT = 4;
+
+using ResponseCallback = std::function<void(bool ok, const std::string &response)>;
+
+struct ScheduledCommand {
+  std::string text;
+  ResponseKind kind{ResponseKind::NONE};
+  CommandPriority priority{CommandPriority::INTERACTIVE};
+  uint32_t enqueued_at{0};
+  ResponseCallback callback;
+};
+
+// The one query the half-duplex link has outstanding. A query that is started is
+// reported to the completion hook exactly once, answered or timed out, unless dropped.
+class QueryInFlight {
+ public:
+  using CompletionHook = std::function<void(bool answered, uint32_t elapsed_ms)>;
+
+  void set_on_complete(CompletionHook &&hook) { this->on_complete_ = std::move(hook); }
+
+  void start(ResponseKind kind, ResponseCallback &&callback, uint32_t now) {
+    this->kind_ = kind;
+    this->callback_ = std::move(callback);
+    this->sent_at_ = now;
+  }
+
+  bool pending() const { return this->kind_ != ResponseKind::NONE; }
+  ResponseKind kind() const { return this->kind_; }
+  // When the last query went out; still valid after it ended
+  uint32_t sent_at() const { return this->sent_at_; }
+
+  // Ends the query and reports its outcome; returns its callback for the caller to run
+  ResponseCallback finish(bool answered, uint32_t now) {
+    ResponseCallback callback = this->take_();
+    if (this->on_complete_)
+      this->on_complete_(answered, now - this->sent_at_);
+    return callback;
+  }
+
+  // Forgets the query without an outcome, for when the meter reset under it: it neither
+  // answered nor timed out, so nothing is reported and its callback is not run
+  void drop() { this->take_(); }
+
+ protected:
+  ResponseCallback take_() {
+    this->kind_ = ResponseKind::NONE;
+    ResponseCallback callback = std::move(this->callback_);
+    this->callback_ = nullptr;
+    return callback;
+  }
+
+  ResponseKind kind_{ResponseKind::NONE};
+  ResponseCallback callback_;
+  uint32_t sent_at_{0};
+  CompletionHook on_complete_;
+};
+
+struct PriorityStats {
+  uint32_t dispatched{0};
+  uint32_t dropped{0};
+  uint32_t max_wait_ms{0};
+  uint64_t total_wait_ms{0};
+};
+
+// Picks the next command for the (half-duplex) instrument link. Classes are served
+// in strict priority order; each class may be limited by a token-bucket rate budget.
+// A class with a minimum share is not starved by busier ones: once it has been passed
+// over that many times while waiting, it goes ahead of them for one command. User
+// commands still come first.
+class CommandScheduler {
+ public:
+  // per_second <= 0 disables the budget for that class
+  void set_rate(CommandPriority priority, float per_second, float burst = 4.0f) {
+    Budget &budget = this->budgets_[index_(priority)];
+    budget.rate = per_second;
+    budget.burst = std::max(burst, 1.0f);
+    budget.tokens = budget.burst;
+  }
+  void set_max_queue(size_t max_queue) { this->max_queue_ = max_queue; }
+  // One command of this class at least every `every` dispatches while it waits, 0 = none
+  void set_min_share(CommandPriority priority, uint8_t every) { this->min_share_[index_(priority)] = every; }
+
+  bool enqueue(ScheduledCommand &&command, uint32_t now) {
+    size_t i = index_(command.priority);
+    if (this->queues_[i].size() >= this->max_queue_) {
+      this->stats_[i].dropped++;
+      if (command.callback)
+        command.callback(false, "");
+      return false;
+    }
+    command.enqueued_at = now;
+    this->queues_[i].push_back(std::move(command));
+    return true;
+  }
+
+  // Moves the highest-priority command that is within its budget into `out`
+  bool next(uint32_t now, ScheduledCommand &out) {
+    for (size_t i = 0; i < PRIORITY_COUNT && this->queues_[index_(CommandPriority::INTERACTIVE)].empty(); i++) {
+      if (this->min_share_[i] == 0 || this->passed_over_[i] < this->min_share_[i] || this->queues_[i].empty() ||
+          !take_token_(this->budgets_[i], now))
+        continue;
+      this->dispatch_(i, now, out);
+      return true;
+    }
+    for (size_t i = 0; i < PRIORITY_COUNT; i++) {
+      if (this->queues_[i].empty() || !take_token_(this->budgets_[i], now))
+        continue;
+      this->dispatch_(i, now, out);
+      return true;
+    }
+    return false;
+  }
+
+  bool has_pending(CommandPriority priority) const { return !this->queues_[index_(priority)].empty(); }
+
+  // Age of the oldest queued command of a class, 0 when the queue is empty
+  uint32_t oldest_wait(CommandPriority priority, uint32_t now) const {
+    const auto &queue = this->queues_[index_(priority)];
+    return queue.empty() ? 0 : now - queue.front().enqueued_at;
+  }
+
+  void clear(CommandPriority priority) {
+    auto &queue = this->queues_[index_(priority)];
+    for (auto &command : queue) {
+      if (command.callback)
+        command.callback(false, "");
+    }
+    queue.clear();
+  }
+
+  const PriorityStats &get_stats(CommandPriority priority) const { return this->stats_[index_(priority)]; }
+
+ protected:
+  struct Budget {
+    float rate{0.0f};
+    float burst{4.0f};
+    float tokens{4.0f};
+    uint32_t last_refill{0};
+  };
+
+  static size_t index_(CommandPriority priority) { return static_cast<size_t>(priority); }
+
+  void dispatch_(size_t i, uint32_t now, ScheduledCommand &out) {
+    out = std::move(this->queues_[i].front());
+    this->queues_[i].pop_front();
+    PriorityStats &stats = this->stats_[i];
+    uint32_t wait = now - out.enqueued_at;
+    stats.dispatched++;
+    stats.total_wait_ms += wait;
+    stats.max_wait_ms = std::max(stats.max_wait_ms, wait);
+    for (size_t j = 0; j < PRIORITY_COUNT; j++) {
+      if (j == i || this->queues_[j].empty()) {
+        this->passed_over_[j] = 0;
+      } else if (this->passed_over_[j] < UINT8_MAX) {
+        this->passed_over_[j]++;
+      }
+    }
+  }
+
+  static bool take_token_(Budget &budget, uint32_t now) {
+    if (budget.rate <= 0.0f)
+      return true;
+    budget.tokens = std::min(budget.burst, budget.tokens + (now - budget.last_refill) * budget.rate / 1000.0f);
+    budget.last_refill = now;
+    if (budget.tokens < 1.0f)
+      return false;
+    budget.tokens -= 1.0f;
+    return true;
+  }
+
+  std::array<std::deque<ScheduledCommand>, PRIORITY_COUNT> queues_;
+  std::array<Budget, PRIORITY_COUNT> budgets_{};
+  std::array<PriorityStats, PRIORITY_COUNT> stats_{};
+  std::array<uint8_t, PRIORITY_COUNT> min_share_{};
+  std::array<uint8_t, PRIORITY_COUNT> passed_over_{};  // dispatches of other classes while waiting
+  size_t max_queue_{16};
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,205 @@
+#pragma once
+
+#ifdef USE_SCPI_DMM_DATALOG
+
+#include <LittleFS.h>
+#include "esphome/core/component.h"
+#include "esphome/core/log.h"
+#include "sample_codec.h"
+#include "sample_pipeline.h"
+#ifdef USE_TIME
+#include "esphome/components/time/real_time_clock.h"
+#endif
+
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Appends are batched up to this size: every append opens and closes the file, and each
+// close is a LittleFS metadata commit, so fewer and larger appends mean fewer commits
+static const size_t DATALOG_PAGE_SIZE = 4096;
+// Left free for LittleFS's metadata pairs and the copy-on-write of a file's last block
+static const size_t DATALOG_FS_RESERVE = 4 * 4096;
+static const size_t DATALOG_RECORD_HEADER_SIZE = 26;
+static const uint8_t DATALOG_RECORD_VERSION = 1;
+
+// Appends compressed samples to a file on LittleFS so readings survive Wi-Fi outages
+// and reboots. Samples are packed into SampleBlocks, sealed blocks are collected in a
+// page buffer and the buffer is appended in one write once the next block would not
+// fit, or after flush_interval_ms. At max_size the file is renamed to "<path>.1"
+// (replacing the previous one) and a new file is started.
+//
+// Record (little-endian), repeated:
+//   offset  size  field
+//   0       2     magic "XB"
+//   2       1     version (1)
+//   3       1     function (MeasurementFunction index)
+//   4       1     source (instrument index)
+//   5       1     reserved (0)
+//   6       2     sample count
+//   8       2     bit length of the encoded stream
+//   10      4     uptime of the first sample in ms
+//   14      4     first value, float32
+//   18      8     epoch of the first sample in ms, 0 when unknown
+//   26      n     encoded stream, see SampleBlock (n = ceil(bit length / 8))
+class FlashLogger {
+ public:
+  FlashLogger(std::string path, size_t max_size, uint32_t flush_interval_ms)
+      : path_(std::move(path)), max_size_(max_size), flush_interval_ms_(flush_interval_ms) {
+    this->rotated_path_ = this->path_ + ".1";
+    this->page_.reserve(DATALOG_PAGE_SIZE);
+  }
+
+#ifdef USE_TIME
+  void set_time(time::RealTimeClock *clock) { this->clock_ = clock; }
+#endif
+
+  void setup() {
+    if (!LittleFS.begin(true)) {
+      ESP_LOGE("scpi_dmm", "Could not mount LittleFS, data logging disabled");
+      return;
+    }
+    // The current and the rotated file must both fit on the partition
+    size_t total = LittleFS.totalBytes();
+    size_t limit = total > DATALOG_FS_RESERVE ? (total - DATALOG_FS_RESERVE) / 2 : 0;
+    if (limit < DATALOG_PAGE_SIZE) {
+      ESP_LOGE("scpi_dmm", "LittleFS partition too small (%u bytes), data logging disabled", (unsigned) total);
+      return;
+    }
+    if (this->max_size_ > limit) {
+      ESP_LOGW("scpi_dmm", "max_size lowered to %u bytes to fit the %u byte LittleFS partition", (unsigned) limit,
+               (unsigned) total);
+      this->max_size_ = limit;
+    }
+    this->mounted_ = true;
+    fs::File file = LittleFS.open(this->path_.c_str(), FILE_APPEND);
+    if (file) {
+      this->file_size_ = file.size();
+      file.close();
+    }
+    ESP_LOGI("scpi_dmm", "Logging to %s (%u bytes so far)", this->path_.c_str(), (unsigned) this->file_size_);
+  }
+
+  void add(const Sample &sample) {
+    if (!this->mounted_)
+      return;
+    if (this->block_.count > 0 && this->encoder_.append(this->block_, sample))
+      return;
+    this->seal_block_();
+    if (this->page_.empty())
+      this->pending_since_ = sample.timestamp_ms;
+    this->encoder_.start(this->block_, sample);
+    this->block_epoch_ = this->epoch_ms_(sample.timestamp_ms);
+  }
+
+  void loop() {
+    if (!this->mounted_ || (this->page_.empty() && this->block_.count == 0))
+      return;
+    if (millis() - this->pending_since_ >= this->flush_interval_ms_)
+      this->flush();
+  }
+
+  // Writes everything buffered, including the open block
+  void flush() {
+    if (!this->mounted_)
+      return;
+    this->seal_block_();
+    this->write_page_();
+  }
+
+  const std::string &get_path() const { return this->path_; }
+  const std::string &get_rotated_path() const { return this->rotated_path_; }
+  uint32_t get_write_count() const { return this->writes_; }
+
+ protected:
+  // Moves the open block into the page buffer
+  void seal_block_() {
+    if (this->block_.count == 0)
+      return;
+    size_t data_bytes = this->block_.data_bytes();
+    if (this->page_.size() + DATALOG_RECORD_HEADER_SIZE + data_bytes > DATALOG_PAGE_SIZE)
+      this->write_page_();
+    if (this->page_.empty())
+      this->pending_since_ = this->block_.first_ms;
+
+    uint8_t header[DATALOG_RECORD_HEADER_SIZE] = {'X', 'B', DATALOG_RECORD_VERSION};
+    header[3] = static_cast<uint8_t>(this->block_.function);
+    header[4] = this->block_.source;
+    put_le_(header + 6, this->block_.count, 2);
+    put_le_(header + 8, this->block_.bit_length, 2);
+    put_le_(header + 10, this->block_.first_ms, 4);
+    put_le_(header + 14, this->block_.first_bits, 4);
+    put_le_(header + 18, this->block_epoch_, 8);
+    this->page_.insert(this->page_.end(), header, header + DATALOG_RECORD_HEADER_SIZE);
+    this->page_.insert(this->page_.end(), this->block_.data, this->block_.data + data_bytes);
+    this->block_.count = 0;
+  }
+
+  void write_page_() {
+    if (this->page_.empty())
+      return;
+    if (this->file_size_ > 0 && this->file_size_ + this->page_.size() > this->max_size_)
+      this->rotate_();
+    // Open per write so a power cut loses at most the RAM buffer, never the file
+    fs::File file = LittleFS.open(this->path_.c_str(), FILE_APPEND);
+    if (!file) {
+      ESP_LOGW("scpi_dmm", "Could not open %s, dropping %u bytes", this->path_.c_str(), (unsigned) this->page_.size());
+    } else {
+      size_t written = file.write(this->page_.data(), this->page_.size());
+      file.close();
+      this->file_size_ += written;
+      this->writes_++;
+      if (written != this->page_.size())
+        ESP_LOGW("scpi_dmm", "Short write to %s (%u of %u bytes), flash full?", this->path_.c_str(),
+                 (unsigned) written, (unsigned) this->page_.size());
+    }
+    this->page_.clear();
+  }
+
+  void rotate_() {
+    ESP_LOGI("scpi_dmm", "Rotating %s at %u bytes", this->path_.c_str(), (unsigned) this->file_size_);
+    if (LittleFS.exists(this->rotated_path_.c_str()))
+      LittleFS.remove(this->rotated_path_.c_str());
+    LittleFS.rename(this->path_.c_str(), this->rotated_path_.c_str());
+    this->file_size_ = 0;
+  }
+
+  uint64_t epoch_ms_(uint32_t timestamp_ms) const {
+#ifdef USE_TIME
+    if (this->clock_ != nullptr) {
+      ESPTime now = this->clock_->now();
+      if (now.is_valid())
+        return uint64_t(now.timestamp) * 1000 - (millis() - timestamp_ms);
+    }
+#endif
+    return 0;
+  }
+
+  static void put_le_(uint8_t *out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+      out[i] = (value >> (8 * i)) & 0xFF;
+  }
+
+  std::string path_;
+  std::string rotated_path_;
+  size_t max_size_;
+  uint32_t flush_interval_ms_;
+  bool mounted_{false};
+  size_t file_size_{0};
+  uint32_t writes_{0};
+  SampleBlock block_;
+  SampleBlockEncoder encoder_;
+  uint64_t block_epoch_{0};
+  std::vector<uint8_t> page_;
+  uint32_t pending_since_{0};  // uptime of the oldest sample not yet on flash
+#ifdef USE_TIME
+  time::RealTimeClock *clock_{nullptr};
+#endif
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
+
+#endif  // USE_SCPI_DMM_DATALOG
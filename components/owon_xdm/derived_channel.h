@@ -0,0 +1,153 @@
+#pragma once
+
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/core/hal.h"
+#include "sample_pipeline.h"
+
+#include <cmath>
+
+namespace esphome {
+namespace scpi_dmm {
+
+enum class DerivedOperation : uint8_t {
+  MULTIPLY,   // a * b, e.g. V x I power
+  DIVIDE,     // a / b, e.g. Vout / Vin
+  EFFICIENCY  // 100 * a / b in %, e.g. Pout / Pin
+};
+
+// Pipeline samples an input accepts; UNKNOWN matches any function
+struct ChannelInput {
+  uint8_t source;
+  MeasurementFunction function;
+
+  bool matches(const Sample &sample) const {
+    return sample.source == this->source &&
+           (this->function == MeasurementFunction::UNKNOWN || sample.function == this->function);
+  }
+};
+
+// Combines two pipeline inputs into one sensor at acquisition rate. Every sample of
+// input a is paired with input b linearly interpolated at the same timestamp, so
+// meters polled at different moments are still combined at a common instant. An a
+// sample waits until a b sample at or after its timestamp arrives; if b is more than
+// max_skew_ms away on either side the pair is dropped rather than combined with stale
+// data. With an output source set, results are pushed back into the pipeline so
+// they can be logged, streamed or used as the input of another channel.
+class DerivedChannel : public sensor::Sensor {
+ public:
+  DerivedChannel(DerivedOperation operation, ChannelInput a, ChannelInput b, uint32_t max_skew_ms)
+      : operation_(operation), a_(a), b_(b), max_skew_ms_(max_skew_ms) {}
+
+  void set_output_source(uint8_t source) {
+    this->output_source_ = source;
+    this->has_output_source_ = true;
+  }
+
+  void attach(SamplePipeline *pipeline) {
+    this->pipeline_ = pipeline;
+    pipeline->add_sink([this](const Sample &sample) { this->on_sample_(sample); });
+  }
+
+  uint32_t get_dropped() const { return this->dropped_; }
+
+ protected:
+  static const size_t MAX_PENDING = 8;
+
+  void on_sample_(const Sample &sample) {
+    if (this->a_.matches(sample)) {
+      // Keep the newest few; an a sample older than max_skew behind the last b can never pair
+      if (this->pending_count_ == MAX_PENDING) {
+        this->drop_oldest_();
+      }
+      this->pending_[(this->pending_head_ + this->pending_count_) % MAX_PENDING] = sample;
+      this->pending_count_++;
+    }
+    if (this->b_.matches(sample)) {
+      // A function change on b invalidates interpolation across it
+      if (this->have_b_ && sample.function != this->b_last_.function)
+        this->have_b_prev_ = false;
+      else if (this->have_b_)
+        this->have_b_prev_ = true;
+      this->b_prev_ = this->b_last_;
+      this->b_last_ = sample;
+      this->have_b_ = true;
+    }
+    if (this->have_b_)
+      this->drain_();
+  }
+
+  // Pairs every pending a sample that b has caught up with
+  void drain_() {
+    while (this->pending_count_ > 0) {
+      const Sample &a = this->pending_[this->pending_head_];
+      if (a.timestamp_ms > this->b_last_.timestamp_ms) {
+        // b has not reached this instant yet; give up only when it is clearly not coming
+        if (a.timestamp_ms - this->b_last_.timestamp_ms > this->max_skew_ms_ &&
+            millis() - a.timestamp_ms > this->max_skew_ms_) {
+          this->drop_oldest_();
+          continue;
+        }
+        return;
+      }
+      float b;
+      if (this->have_b_prev_ && a.timestamp_ms >= this->b_prev_.timestamp_ms) {
+        uint32_t span = this->b_last_.timestamp_ms - this->b_prev_.timestamp_ms;
+        float fraction = span == 0 ? 1.0f : float(a.timestamp_ms - this->b_prev_.timestamp_ms) / span;
+        b = this->b_prev_.value + (this->b_last_.value - this->b_prev_.value) * fraction;
+      } else if (this->b_last_.timestamp_ms - a.timestamp_ms <= this->max_skew_ms_) {
+        b = this->b_last_.value;
+      } else {
+        this->drop_oldest_();
+        continue;
+      }
+      Sample pair = a;
+      this->pending_head_ = (this->pending_head_ + 1) % MAX_PENDING;
+      this->pending_count_--;
+      this->emit_(pair.timestamp_ms, this->compute_(pair.value, b));
+    }
+  }
+
+  float compute_(float a, float b) const {
+    switch (this->operation_) {
+      case DerivedOperation::MULTIPLY:
+        return a * b;
+      case DerivedOperation::DIVIDE:
+        return b == 0.0f ? NAN : a / b;
+      case DerivedOperation::EFFICIENCY:
+        return b == 0.0f ? NAN : 100.0f * a / b;
+    }
+    return NAN;
+  }
+
+  void emit_(uint32_t timestamp_ms, float value) {
+    this->publish_state(value);
+    if (this->has_output_source_ && this->pipeline_ != nullptr && !std::isnan(value))
+      this->pipeline_->push(Sample{timestamp_ms, value, MeasurementFunction::DERIVED, this->output_source_, timestamp_ms});
+  }
+
+  void drop_oldest_() {
+    this->pending_head_ = (this->pending_head_ + 1) % MAX_PENDING;
+    this->pending_count_--;
+    this->dropped_++;
+  }
+
+  DerivedOperation operation_;
+  ChannelInput a_;
+  ChannelInput b_;
+  uint32_t max_skew_ms_;
+  SamplePipeline *pipeline_{nullptr};
+  uint8_t output_source_{0};
+  bool has_output_source_{false};
+
+  Sample pending_[MAX_PENDING];
+  size_t pending_head_{0};
+  size_t pending_count_{0};
+  Sample b_prev_{};
+  Sample b_last_{};
+  bool have_b_{false};
+  bool have_b_prev_{false};
+  uint32_t dropped_{0};
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
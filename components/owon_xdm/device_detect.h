@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Maps an *IDN? reply to a DEVICE_COMMANDS key. Both keyword lists are '|'-separated
+// and matched case-insensitively against the manufacturer and model fields.
+struct IdnRule {
+  const char *profile;
+  const char *manufacturers;
+  const char *models;
+};
+
+// Add a rule next to each profile in DEVICE_COMMANDS
+static const IdnRule IDN_RULES[] = {
+    {"OWON_XDM", "OWON", "XDM"},
+    {"KEYSIGHT_34460A", "KEYSIGHT|AGILENT", "34460A"},
+};
+
+static const char *const GENERIC_PROFILE = "GENERIC_SCPI";
+
+// Field n of a comma-separated IDN reply ("manufacturer,model,serial,firmware"), upper-cased
+inline std::string idn_field(const std::string &idn, size_t n) {
+  size_t start = 0;
+  for (size_t i = 0; i < n; i++) {
+    start = idn.find(',', start);
+    if (start == std::string::npos)
+      return "";
+    start++;
+  }
+  size_t end = idn.find(',', start);
+  std::string field = idn.substr(start, end == std::string::npos ? std::string::npos : end - start);
+  std::transform(field.begin(), field.end(), field.begin(), ::toupper);
+  return field;
+}
+
+// True when field contains any of the '|'-separated keywords
+inline bool idn_contains_any(const std::string &field, const char *keywords) {
+  const char *begin = keywords;
+  while (true) {
+    const char *end = strchr(begin, '|');
+    size_t length = end == nullptr ? strlen(begin) : end - begin;
+    if (length > 0 && field.find(begin, 0, length) != std::string::npos)
+      return true;
+    if (end == nullptr)
+      return false;
+    begin = end + 1;
+  }
+}
+
+// A real *IDN? reply: printable ASCII with the four comma-separated fields of IEEE 488.2.
+// At the wrong baud rate the answer arrives as line noise instead.
+inline bool idn_plausible(const std::string &reply) {
+  if (std::count(reply.begin(), reply.end(), ',') < 3)
+    return false;
+  return std::all_of(reply.begin(), reply.end(), [](char c) { return c >= 0x20 && c < 0x7F; });
+}
+
+// Profile key for an IDN reply, GENERIC_PROFILE when no rule matches
+inline const char *detect_profile(const std::string &idn) {
+  std::string manufacturer = idn_field(idn, 0);
+  std::string model = idn_field(idn, 1);
+  for (const IdnRule &rule : IDN_RULES) {
+    if (idn_contains_any(manufacturer, rule.manufacturers) && idn_contains_any(model, rule.models))
+      return rule.profile;
+  }
+  return GENERIC_PROFILE;
+}
+
+// Last detection result, kept in flash so the next boot starts with the right command
+// set instead of waiting for *IDN?. idn_hash identifies the meter it was detected on.
+struct DetectedProfile {
+  uint32_t idn_hash;
+  char profile[24];
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+#include "sample_codec.h"
+#include "sample_pipeline.h"
+
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Query times are uptime in ms; negative values count back from now, -1 meaning now
+inline uint32_t resolve_history_time(int64_t value, uint32_t now) {
+  if (value >= 0)
+    return static_cast<uint32_t>(value);
+  return value == -1 ? now : now - static_cast<uint32_t>(-value);
+}
+
+// Per-bucket summary returned by HistoryRing::summarize()
+struct HistorySummary {
+  uint32_t start_ms;
+  MeasurementFunction function;
+  uint32_t count;
+  float min;
+  float max;
+  float mean;
+};
+
+// Rolling in-RAM measurement history kept as compressed SampleBlocks. Only the block
+// being written is full size; once closed a block is stored trimmed to its encoded
+// bytes, so a function change costs a few header bytes instead of a whole block. When
+// memory_bytes is used up the oldest blocks are dropped.
+class HistoryRing {
+ public:
+  explicit HistoryRing(size_t memory_bytes) : memory_bytes_(memory_bytes), open_(new SampleBlock()) {}
+
+  void append(const Sample &sample) {
+    LockGuard guard(this->lock_);
+    if (this->open_->count == 0) {
+      this->encoder_.start(*this->open_, sample);
+    } else if (!this->encoder_.append(*this->open_, sample)) {
+      this->close_open_();
+      this->encoder_.start(*this->open_, sample);
+    }
+    this->sample_count_++;
+  }
+
+  // Emits raw samples with t0 <= timestamp <= t1, oldest first; returns how many were emitted
+  size_t query(uint32_t t0, uint32_t t1, size_t limit, const std::function<void(const Sample &)> &emit) {
+    size_t emitted = 0;
+    this->for_each_block_(t0, t1, [&](const SampleBlock &block) {
+      decode_sample_block(block, [&](const Sample &sample) {
+        if (emitted >= limit || sample.timestamp_ms < t0 || sample.timestamp_ms > t1)
+          return emitted < limit;
+        emit(sample);
+        return ++emitted < limit;
+      });
+      return emitted < limit;
+    });
+    return emitted;
+  }
+
+  // Emits min/max/mean per bucket_ms-wide bucket; a function change also closes the bucket
+  void summarize(uint32_t t0, uint32_t t1, uint32_t bucket_ms, const std::function<void(const HistorySummary &)> &emit) {
+    bucket_ms = std::max<uint32_t>(bucket_ms, 1);
+    HistorySummary current{0, MeasurementFunction::UNKNOWN, 0, 0.0f, 0.0f, 0.0f};
+    double sum = 0.0;
+    auto close = [&]() {
+      if (current.count == 0)
+        return;
+      current.mean = sum / current.count;
+      emit(current);
+      current.count = 0;
+      sum = 0.0;
+    };
+    this->for_each_block_(t0, t1, [&](const SampleBlock &block) {
+      decode_sample_block(block, [&](const Sample &sample) {
+        if (sample.timestamp_ms < t0 || sample.timestamp_ms > t1)
+          return true;
+        uint32_t start = t0 + (sample.timestamp_ms - t0) / bucket_ms * bucket_ms;
+        if (current.count > 0 && (start != current.start_ms || sample.function != current.function))
+          close();
+        if (current.count == 0) {
+          current = HistorySummary{start, sample.function, 0, sample.value, sample.value, 0.0f};
+        }
+        current.count++;
+        current.min = std::min(current.min, sample.value);
+        current.max = std::max(current.max, sample.value);
+        sum += sample.value;
+        return true;
+      });
+      return true;
+    });
+    close();
+  }
+
+  size_t get_sample_count() const { return this->sample_count_; }
+  size_t get_capacity_bytes() const { return this->memory_bytes_; }
+  uint32_t get_oldest_ms() {
+    LockGuard guard(this->lock_);
+    if (!this->closed_.empty())
+      return this->closed_.front().first_ms;
+    return this->open_->count > 0 ? this->open_->first_ms : 0;
+  }
+
+ protected:
+  // A closed block, its encoded stream trimmed to data_bytes()
+  struct StoredBlock {
+    uint32_t first_ms;
+    uint32_t last_ms;
+    uint32_t first_bits;
+    uint16_t count;
+    uint16_t bit_length;
+    MeasurementFunction function;
+    uint8_t source;
+    std::unique_ptr<uint8_t[]> data;
+
+    size_t data_bytes() const { return (this->bit_length + 7) / 8; }
+    size_t footprint() const { return sizeof(StoredBlock) + this->data_bytes(); }
+  };
+
+  void close_open_() {
+    const SampleBlock &open = *this->open_;
+    StoredBlock stored{open.first_ms, open.last_ms,    open.first_bits, open.count,
+                       open.bit_length, open.function, open.source,     nullptr};
+    stored.data.reset(new uint8_t[stored.data_bytes()]);
+    memcpy(stored.data.get(), open.data, stored.data_bytes());
+    // The open block is always allocated; closed blocks share what is left
+    size_t budget = this->memory_bytes_ > sizeof(SampleBlock) ? this->memory_bytes_ - sizeof(SampleBlock) : 0;
+    while (!this->closed_.empty() && this->closed_bytes_ + stored.footprint() > budget) {
+      this->closed_bytes_ -= this->closed_.front().footprint();
+      this->sample_count_ -= this->closed_.front().count;
+      this->closed_.pop_front();
+      this->first_seq_++;
+    }
+    this->closed_bytes_ += stored.footprint();
+    this->closed_.push_back(std::move(stored));
+  }
+
+  // Visits blocks overlapping [t0, t1] oldest first until the visitor returns false.
+  // Each block is copied out under the lock and decoded without it, so a long query
+  // from the web server only holds up append() for one block copy at a time. Blocks
+  // dropped in between are skipped, and blocks started after the query are not seen.
+  template<typename F> void for_each_block_(uint32_t t0, uint32_t t1, F &&visit) {
+    std::unique_ptr<SampleBlock> copy(new SampleBlock());
+    uint32_t seq = 0;
+    uint32_t end_seq = 0;
+    bool first = true;
+    while (true) {
+      {
+        LockGuard guard(this->lock_);
+        const uint32_t open_seq = this->first_seq_ + this->closed_.size();
+        if (first) {
+          end_seq = open_seq;
+          first = false;
+        }
+        seq = std::max(seq, this->first_seq_);
+        bool found = false;
+        for (; seq <= end_seq && !found; seq++) {
+          if (seq < open_seq) {
+            const StoredBlock &block = this->closed_[seq - this->first_seq_];
+            if (block.last_ms < t0 || block.first_ms > t1)
+              continue;
+            copy->first_ms = block.first_ms;
+            copy->last_ms = block.last_ms;
+            copy->first_bits = block.first_bits;
+            copy->count = block.count;
+            copy->bit_length = block.bit_length;
+            copy->function = block.function;
+            copy->source = block.source;
+            memcpy(copy->data, block.data.get(), block.data_bytes());
+          } else {
+            const SampleBlock &block = *this->open_;
+            if (block.count == 0 || block.last_ms < t0 || block.first_ms > t1)
+              continue;
+            *copy = block;
+          }
+          found = true;
+        }
+        if (!found)
+          return;
+      }
+      if (!visit(*copy))
+        return;
+    }
+  }
+
+  size_t memory_bytes_;
+  std::unique_ptr<SampleBlock> open_;  // block being written
+  SampleBlockEncoder encoder_;         // state of open_
+  std::deque<StoredBlock> closed_;     // oldest first
+  size_t closed_bytes_{0};
+  uint32_t first_seq_{0};  // number of closed_.front() among all blocks ever closed
+  size_t sample_count_{0};
+  // Queries may come from the web server task
+  Mutex lock_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+#include "sample_pipeline.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+class LiveStream;
+
+// Read position of one connected stream client. Owned by the HTTP response, so it
+// goes away with the connection.
+struct LiveStreamClient {
+  explicit LiveStreamClient(LiveStream *stream, uint32_t next_seq) : stream(stream), next_seq(next_seq) {}
+  ~LiveStreamClient();
+
+  LiveStream *stream;
+  uint32_t next_seq;
+  uint32_t dropped{0};
+  bool greeted{false};
+};
+
+// Fan-out of the sample pipeline to Server-Sent Events clients. Acquisition only
+// appends to a ring of recent samples; every client keeps its own cursor and is
+// served as fast as its TCP connection drains. A client that falls behind gets its
+// backlog decimated (every n-th sample, "stride" in the frame) so it catches up,
+// and if it falls further behind than the ring holds, the missing samples are
+// counted in "dropped". Either way the meter is never held up by a slow reader.
+//
+// Frame: event: samples
+//        data: {"seq":120,"function":"VOLT:DC","stride":1,"dropped":0,"s":[[t_ms,value],...]}
+class LiveStream {
+ public:
+  LiveStream(size_t capacity, uint16_t max_batch, uint8_t max_clients)
+      : ring_(std::max<size_t>(capacity, 16)), max_batch_(max_batch), max_clients_(max_clients) {}
+
+  void push(const Sample &sample) {
+    LockGuard guard(this->lock_);
+    this->ring_[this->head_seq_ % this->ring_.size()] = sample;
+    this->head_seq_++;
+  }
+
+  // New clients start at the live edge; nullptr when all slots are taken
+  std::shared_ptr<LiveStreamClient> connect() {
+    LockGuard guard(this->lock_);
+    if (this->clients_ >= this->max_clients_)
+      return nullptr;
+    this->clients_++;
+    return std::make_shared<LiveStreamClient>(this, this->head_seq_);
+  }
+
+  void disconnect() {
+    LockGuard guard(this->lock_);
+    this->clients_--;
+  }
+
+  // Writes as much of the client's backlog as fits into buffer as one SSE frame.
+  // Returns 0 when there is nothing to send yet.
+  size_t fill(LiveStreamClient &client, uint8_t *buffer, size_t max_len) {
+    char *out = reinterpret_cast<char *>(buffer);
+    size_t pos = 0;
+    if (!client.greeted) {
+      // Comment line so EventSource fires onopen right away
+      static const char HELLO[] = ": scpi_dmm\n\n";
+      if (max_len < sizeof(HELLO))
+        return 0;
+      memcpy(out, HELLO, sizeof(HELLO) - 1);
+      client.greeted = true;
+      return sizeof(HELLO) - 1;
+    }
+
+    LockGuard guard(this->lock_);
+    uint32_t oldest = this->head_seq_ - std::min<uint32_t>(this->head_seq_, this->ring_.size());
+    if (client.next_seq < oldest) {
+      client.dropped += oldest - client.next_seq;
+      client.next_seq = oldest;
+    }
+    uint32_t backlog = this->head_seq_ - client.next_seq;
+    if (backlog == 0)
+      return 0;
+    uint32_t stride = (backlog + this->max_batch_ - 1) / this->max_batch_;
+
+    const Sample &first = this->at_(client.next_seq);
+    static const size_t TAIL = 4;  // "]}\n\n"
+    int n = snprintf(out, max_len, "event: samples\ndata: {\"seq\":%u,\"function\":\"%s\",\"stride\":%u,\"dropped\":%u,\"s\":[",
+                     (unsigned) client.next_seq, function_to_string(first.function), (unsigned) stride,
+                     (unsigned) client.dropped);
+    if (n < 0 || size_t(n) + TAIL >= max_len)
+      return 0;
+    pos = n;
+
+    uint32_t seq = client.next_seq;
+    size_t count = 0;
+    char item[40];
+    while (seq < this->head_seq_) {
+      const Sample &sample = this->at_(seq);
+      // One unit per frame
+      if (sample.function != first.function)
+        break;
+      int len = snprintf(item, sizeof(item), "%s[%u,%g]", count == 0 ? "" : ",", (unsigned) sample.timestamp_ms,
+                         sample.value);
+      if (pos + len + TAIL > max_len)
+        break;
+      memcpy(out + pos, item, len);
+      pos += len;
+      count++;
+      seq = std::min(seq + stride, this->head_seq_);
+    }
+    if (count == 0)
+      return 0;
+    memcpy(out + pos, "]}\n\n", TAIL);
+    client.next_seq = seq;
+    return pos + TAIL;
+  }
+
+  uint8_t get_client_count() const { return this->clients_; }
+
+ protected:
+  const Sample &at_(uint32_t seq) const { return this->ring_[seq % this->ring_.size()]; }
+
+  std::vector<Sample> ring_;
+  uint32_t head_seq_{0};  // sequence number of the next sample
+  uint16_t max_batch_;
+  uint8_t max_clients_;
+  uint8_t clients_{0};
+  // Clients are served from the web server task
+  Mutex lock_;
+};
+
+inline LiveStreamClient::~LiveStreamClient() { this->stream->disconnect(); }
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+#include "command_scheduler.h"
+#include "sample_clock.h"
+#include "sample_pipeline.h"
+
+#include <array>
+#include <cmath>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Query round-trip buckets (upper bounds in ms), cumulative like Prometheus histograms
+static const uint16_t LATENCY_BUCKETS_MS[] = {5, 10, 20, 50, 100, 200, 500};
+static const size_t LATENCY_BUCKET_COUNT = sizeof(LATENCY_BUCKETS_MS) / sizeof(LATENCY_BUCKETS_MS[0]);
+
+struct LatencyHistogram {
+  std::array<uint32_t, LATENCY_BUCKET_COUNT> buckets{};  // non-cumulative
+  uint32_t count{0};
+  uint64_t sum_ms{0};
+
+  void observe(uint32_t ms) {
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+      if (ms <= LATENCY_BUCKETS_MS[i]) {
+        this->buckets[i]++;
+        break;
+      }
+    }
+    this->count++;
+    this->sum_ms += ms;
+  }
+};
+
+// Running statistics of one measurement function since boot
+struct FunctionStats {
+  uint32_t count{0};
+  uint32_t last_ms{0};
+  float last{NAN};
+  float min{NAN};
+  float max{NAN};
+  double sum{0.0};
+};
+
+// Counters for the /metrics endpoint. Updated from the main loop and read from the
+// web server task; take lock() around reads so a scrape sees a consistent snapshot.
+class Metrics {
+ public:
+  void add_sample(const Sample &sample) {
+    LockGuard guard(this->lock_);
+    FunctionStats &stats = this->functions_[static_cast<size_t>(sample.function)];
+    if (stats.count == 0 || sample.value < stats.min)
+      stats.min = sample.value;
+    if (stats.count == 0 || sample.value > stats.max)
+      stats.max = sample.value;
+    stats.count++;
+    stats.sum += sample.value;
+    stats.last = sample.value;
+    stats.last_ms = sample.timestamp_ms;
+  }
+
+  void on_query(bool answered, uint32_t latency_ms) {
+    LockGuard guard(this->lock_);
+    if (answered) {
+      this->latency_.observe(latency_ms);
+    } else {
+      this->timeouts_++;
+    }
+  }
+
+  // Answered, but not with a reading (error text, overload, mis-framed line)
+  void on_invalid() {
+    LockGuard guard(this->lock_);
+    this->invalid_++;
+  }
+
+  void on_unsolicited() {
+    LockGuard guard(this->lock_);
+    this->unsolicited_++;
+  }
+
+  // Scheduler counters are owned by the main loop; they are copied here periodically
+  void update_scheduler(const CommandScheduler &scheduler) {
+    LockGuard guard(this->lock_);
+    for (size_t i = 0; i < PRIORITY_COUNT; i++)
+      this->scheduler_[i] = scheduler.get_stats(static_cast<CommandPriority>(i));
+  }
+
+  void update_clock(const SampleClock &clock) {
+    LockGuard guard(this->lock_);
+    this->clock_running_ = clock.is_running();
+    this->clock_ = clock.get_stats();
+  }
+
+  Mutex &lock() { return this->lock_; }
+  const FunctionStats &get_function(size_t index) const { return this->functions_[index]; }
+  const LatencyHistogram &get_latency() const { return this->latency_; }
+  const PriorityStats &get_scheduler(size_t index) const { return this->scheduler_[index]; }
+  uint32_t get_timeouts() const { return this->timeouts_; }
+  uint32_t get_unsolicited() const { return this->unsolicited_; }
+  uint32_t get_invalid() const { return this->invalid_; }
+  bool has_clock() const { return this->clock_running_; }
+  const ClockStats &get_clock() const { return this->clock_; }
+
+ protected:
+  std::array<FunctionStats, FUNCTION_COUNT> functions_{};
+  std::array<PriorityStats, PRIORITY_COUNT> scheduler_{};
+  LatencyHistogram latency_;
+  ClockStats clock_;
+  bool clock_running_{false};
+  uint32_t timeouts_{0};
+  uint32_t unsolicited_{0};
+  uint32_t invalid_{0};
+  Mutex lock_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
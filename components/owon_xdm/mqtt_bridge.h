@@ -0,0 +1,161 @@
+#pragma once
+
+#ifdef USE_MQTT
+
+#include "esphome/components/json/json_util.h"
+#include "esphome/components/mqtt/mqtt_client.h"
+#include "esphome/core/component.h"
+#include "esphome/core/log.h"
+#include "command_scheduler.h"
+#include "watchdog.h"
+
+#include <functional>
+#include <string>
+
+namespace esphome {
+namespace scpi_dmm {
+
+using CommandSender = std::function<void(const std::string &command, ResponseCallback callback)>;
+
+// MQTT <-> SCPI bridge. Payloads on the command topic are either a bare command
+// ("MEAS1?") or JSON with a correlation ID ({"id":"42","cmd":"MEAS1?"}); several
+// commands may be sent in one payload separated by newlines. Every command is queued
+// as interactive traffic and its reply is published as soon as the line is framed,
+// so commands are pipelined instead of waiting on each other.
+class MQTTBridge {
+ public:
+  MQTTBridge(std::string command_topic, std::string response_topic, std::string status_topic, CommandSender sender)
+      : command_topic_(std::move(command_topic)),
+        response_topic_(std::move(response_topic)),
+        status_topic_(std::move(status_topic)),
+        sender_(std::move(sender)) {}
+
+  // Topics left empty in the configuration become base + "/cmd", "/resp" and "/status"
+  void set_default_topics(const std::string &base) {
+    if (this->command_topic_.empty())
+      this->command_topic_ = base + "/cmd";
+    if (this->response_topic_.empty())
+      this->response_topic_ = base + "/resp";
+    if (this->status_topic_.empty())
+      this->status_topic_ = base + "/status";
+  }
+
+  // Mirrors the component's LinkWatchdog; commands are refused while it has given up
+  void set_link_state(LinkState state) {
+    this->link_state_ = state;
+    this->publish_status_();
+  }
+
+  void setup() {
+    mqtt::global_mqtt_client->subscribe(
+        this->command_topic_,
+        [this](const std::string &topic, const std::string &payload) { this->on_message_(payload); }, 0);
+  }
+
+  void loop() {
+    // Re-announce the retained status after every (re)connect
+    bool connected = mqtt::global_mqtt_client->is_connected();
+    if (connected && !this->was_connected_)
+      this->publish_status_();
+    this->was_connected_ = connected;
+  }
+
+ protected:
+  void on_message_(const std::string &payload) {
+    // Brokers and some clients deliver retries back-to-back; drop exact repeats within 20 ms
+    const uint32_t now = millis();
+    if (payload == this->last_payload_ && now - this->last_payload_at_ < DEDUPE_MS)
+      return;
+    this->last_payload_ = payload;
+    this->last_payload_at_ = now;
+
+    std::string id;
+    std::string commands = payload;
+    if (!payload.empty() && payload[0] == '{') {
+      bool parsed = json::parse_json(payload, [&id, &commands](JsonObject root) -> bool {
+        JsonVariant value = root["id"];
+        if (value.is<const char *>()) {
+          id = value.as<std::string>();
+        } else if (!value.isNull()) {
+          // Numeric IDs are accepted too and echoed back as strings
+          serializeJson(value, id);
+        }
+        commands = root["cmd"] | "";
+        return true;
+      });
+      if (!parsed) {
+        ESP_LOGW("scpi_dmm", "MQTT command is not valid JSON: %s", payload.c_str());
+        return;
+      }
+    }
+
+    uint16_t seq = 0;
+    size_t start = 0;
+    while (start < commands.size()) {
+      size_t end = commands.find('\n', start);
+      if (end == std::string::npos)
+        end = commands.size();
+      std::string command = commands.substr(start, end - start);
+      start = end + 1;
+      while (!command.empty() && (command.back() == '\r' || command.back() == ' '))
+        command.pop_back();
+      if (command.empty())
+        continue;
+      this->submit_(id, seq++, command);
+    }
+  }
+
+  void submit_(const std::string &id, uint16_t seq, const std::string &command) {
+    ESP_LOGD("scpi_dmm", "MQTT command: %s", command.c_str());
+    if (this->link_state_ == LinkState::OFFLINE || this->link_state_ == LinkState::PROBING) {
+      this->publish_response_(id, seq, command, false, "offline");
+      return;
+    }
+    bool query = command.back() == '?';
+    this->sender_(command, [this, id, seq, command, query](bool ok, const std::string &response) {
+      // Writes only get an acknowledgement when the caller asked for correlation
+      if (!query && id.empty())
+        return;
+      this->publish_response_(id, seq, command, ok, ok ? response : "timeout");
+    });
+  }
+
+  void publish_response_(const std::string &id, uint16_t seq, const std::string &command, bool ok,
+                         const std::string &response) {
+    if (id.empty()) {
+      // Plain payloads keep the MicroPython bridge's format: just the reply text
+      if (ok)
+        mqtt::global_mqtt_client->publish(this->response_topic_, response);
+      return;
+    }
+    std::string json = json::build_json([&](JsonObject root) {
+      root["id"] = id;
+      if (seq > 0)
+        root["seq"] = seq;
+      root["cmd"] = command;
+      root["ok"] = ok;
+      root[ok ? "response" : "error"] = response;
+    });
+    mqtt::global_mqtt_client->publish(this->response_topic_, json);
+  }
+
+  void publish_status_() {
+    mqtt::global_mqtt_client->publish(this->status_topic_, std::string(link_state_to_string(this->link_state_)), 0, true);
+  }
+
+  static const uint32_t DEDUPE_MS = 20;
+
+  std::string command_topic_;
+  std::string response_topic_;
+  std::string status_topic_;
+  CommandSender sender_;
+  std::string last_payload_;
+  uint32_t last_payload_at_{0};
+  LinkState link_state_{LinkState::ONLINE};
+  bool was_connected_{false};
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
+
+#endif  // USE_MQTT
@@ -0,0 +1,236 @@
+#pragma once
+
+#ifdef USE_MQTT
+
+#include "esphome/components/mqtt/mqtt_client.h"
+#include "esphome/core/component.h"
+#include "esphome/core/log.h"
+#include "outbound_queue.h"
+#include "sample_pipeline.h"
+#ifdef USE_TIME
+#include "esphome/components/time/real_time_clock.h"
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+enum class StreamFormat : uint8_t {
+  JSON,
+  BINARY
+};
+
+// Size of the binary frame header, see MQTTSampleStream
+static const size_t STREAM_HEADER_SIZE = 20;
+static const uint8_t STREAM_FRAME_VERSION = 1;
+
+// Packs samples into one MQTT message per batch. A batch is closed when it holds
+// max_samples, when its first sample is max_age_ms old, or when the function changes,
+// so every batch has a single unit. Batches that cannot be published, from boot until
+// the broker is first reached or during an outage, go to an OutboundQueue. Once
+// connected it is replayed oldest first, one batch per replay_interval_ms, while new
+// batches are published as they close, so a long backlog does not hold up live data.
+//
+// JSON:   {"t0":123456,"epoch_ms":1760000000000,"function":"VOLT:DC","dt":[0,20,21],"v":[1.2,1.21,1.2]}
+//         t0 is the first sample's uptime in ms, dt the delta to the previous sample,
+//         epoch_ms is only present when a time source is configured. Replayed batches
+//         carry "replayed":true.
+//
+// Binary (all fields little-endian):
+//   offset  size  field
+//   0       2     magic "XD"
+//   2       1     version (1)
+//   3       1     function (MeasurementFunction index)
+//   4       2     sample count n
+//   6       1     source (instrument index)
+//   7       1     flags, bit 0: replayed from the outbound queue
+//   8       4     t0, uptime of the first sample in ms
+//   12      8     epoch of the first sample in ms, 0 when unknown
+//   20      2n    uint16 delta to the previous sample in ms (first is 0)
+//   20+2n   4n    float32 values
+class MQTTSampleStream {
+ public:
+  MQTTSampleStream(std::string topic, StreamFormat format, uint16_t max_samples, uint32_t max_age_ms)
+      : topic_(std::move(topic)), format_(format), max_samples_(max_samples), max_age_ms_(max_age_ms) {
+    this->samples_.reserve(max_samples);
+  }
+
+#ifdef USE_TIME
+  void set_time(time::RealTimeClock *clock) { this->clock_ = clock; }
+#endif
+  // Used when no topic was configured
+  void set_default_topic(const std::string &topic) {
+    if (this->topic_.empty())
+      this->topic_ = topic;
+  }
+
+  void set_outbox(size_t memory_bytes, uint32_t replay_interval_ms) {
+    this->outbox_.reset(new OutboundQueue(memory_bytes));
+    this->replay_interval_ms_ = replay_interval_ms;
+  }
+  OutboundQueue *get_outbox() { return this->outbox_.get(); }
+
+  void setup() {
+    if (this->outbox_ != nullptr)
+      this->outbox_->setup();
+  }
+
+  void add(const Sample &sample) {
+    if (!this->samples_.empty()) {
+      const Sample &last = this->samples_.back();
+      // Deltas are uint16 on the wire; a long gap or a unit change starts a new batch
+      if (sample.function != last.function || sample.timestamp_ms - last.timestamp_ms > UINT16_MAX)
+        this->flush();
+    }
+    this->samples_.push_back(sample);
+    if (this->samples_.size() >= this->max_samples_)
+      this->flush();
+  }
+
+  void loop() {
+    bool connected = mqtt::global_mqtt_client->is_connected();
+    if (connected && !this->connected_ && this->get_backlog() > 0)
+      ESP_LOGI("scpi_dmm", "MQTT up, replaying %u queued samples", (unsigned) this->get_backlog());
+    this->connected_ = connected;
+    if (connected && this->get_backlog() > 0 && millis() - this->last_replay_ >= this->replay_interval_ms_) {
+      this->last_replay_ = millis();
+      this->replay_batch_();
+    }
+    if (!this->samples_.empty() && millis() - this->samples_.front().timestamp_ms >= this->max_age_ms_)
+      this->flush();
+  }
+
+  void flush() {
+    if (this->samples_.empty())
+      return;
+    bool published = mqtt::global_mqtt_client->is_connected() && this->publish_(this->samples_, false);
+    if (!published && this->outbox_ != nullptr) {
+      for (const Sample &sample : this->samples_)
+        this->outbox_->add(sample);
+    } else if (!published) {
+      this->dropped_ += this->samples_.size();
+    }
+    this->samples_.clear();
+  }
+
+  uint32_t get_dropped() const {
+    return this->dropped_ + (this->outbox_ != nullptr ? this->outbox_->get_dropped() : 0);
+  }
+  size_t get_backlog() const { return this->outbox_ != nullptr ? this->outbox_->get_sample_count() : 0; }
+
+ protected:
+  uint64_t epoch_ms_(uint32_t timestamp_ms) const {
+#ifdef USE_TIME
+    if (this->clock_ != nullptr) {
+      ESPTime now = this->clock_->now();
+      if (now.is_valid())
+        return uint64_t(now.timestamp) * 1000 - (millis() - timestamp_ms);
+    }
+#endif
+    return 0;
+  }
+
+  // Publishes the oldest queued samples as one batch, split like live batches. They
+  // stay queued until the client accepts them, so a refused publish is retried.
+  void replay_batch_() {
+    size_t count = this->outbox_->peek(this->batch_, this->max_samples_, UINT16_MAX);
+    if (count > 0 && this->publish_(this->batch_, true))
+      this->outbox_->pop(count);
+  }
+
+  // False when the client did not take the message (disconnected, out of buffer)
+  bool publish_(const std::vector<Sample> &samples, bool replayed) {
+    if (this->format_ == StreamFormat::JSON)
+      return this->publish_json_(samples, replayed);
+    return this->publish_binary_(samples, replayed);
+  }
+
+  bool publish_json_(const std::vector<Sample> &samples, bool replayed) {
+    const Sample &first = samples.front();
+    char buf[48];
+    this->buffer_.clear();
+    this->buffer_.reserve(64 + samples.size() * 18);
+    snprintf(buf, sizeof(buf), "{\"t0\":%u", (unsigned) first.timestamp_ms);
+    this->buffer_ += buf;
+    uint64_t epoch = this->epoch_ms_(first.timestamp_ms);
+    if (epoch != 0) {
+      snprintf(buf, sizeof(buf), ",\"epoch_ms\":%llu", (unsigned long long) epoch);
+      this->buffer_ += buf;
+    }
+    this->buffer_ += ",\"function\":\"";
+    this->buffer_ += function_to_string(first.function);
+    this->buffer_ += "\",\"dt\":[";
+    uint32_t previous = first.timestamp_ms;
+    for (size_t i = 0; i < samples.size(); i++) {
+      snprintf(buf, sizeof(buf), "%s%u", i == 0 ? "" : ",", (unsigned) (samples[i].timestamp_ms - previous));
+      previous = samples[i].timestamp_ms;
+      this->buffer_ += buf;
+    }
+    this->buffer_ += "],\"v\":[";
+    for (size_t i = 0; i < samples.size(); i++) {
+      snprintf(buf, sizeof(buf), "%s%g", i == 0 ? "" : ",", samples[i].value);
+      this->buffer_ += buf;
+    }
+    this->buffer_ += replayed ? "],\"replayed\":true}" : "]}";
+    return mqtt::global_mqtt_client->publish(this->topic_, this->buffer_);
+  }
+
+  bool publish_binary_(const std::vector<Sample> &samples, bool replayed) {
+    const Sample &first = samples.front();
+    const size_t count = samples.size();
+    this->buffer_.assign(STREAM_HEADER_SIZE + count * 6, '\0');
+    uint8_t *out = reinterpret_cast<uint8_t *>(&this->buffer_[0]);
+    out[0] = 'X';
+    out[1] = 'D';
+    out[2] = STREAM_FRAME_VERSION;
+    out[3] = static_cast<uint8_t>(first.function);
+    put_le_(out + 4, count, 2);
+    out[6] = first.source;
+    out[7] = replayed ? 0x01 : 0x00;
+    put_le_(out + 8, first.timestamp_ms, 4);
+    put_le_(out + 12, this->epoch_ms_(first.timestamp_ms), 8);
+
+    uint8_t *deltas = out + STREAM_HEADER_SIZE;
+    uint8_t *values = deltas + count * 2;
+    uint32_t previous = first.timestamp_ms;
+    for (size_t i = 0; i < count; i++) {
+      put_le_(deltas + i * 2, samples[i].timestamp_ms - previous, 2);
+      previous = samples[i].timestamp_ms;
+      uint32_t bits;
+      memcpy(&bits, &samples[i].value, sizeof(bits));
+      put_le_(values + i * 4, bits, 4);
+    }
+    return mqtt::global_mqtt_client->publish(this->topic_, this->buffer_.data(), this->buffer_.size());
+  }
+
+  static void put_le_(uint8_t *out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+      out[i] = (value >> (8 * i)) & 0xFF;
+  }
+
+  std::string topic_;
+  StreamFormat format_;
+  uint16_t max_samples_;
+  uint32_t max_age_ms_;
+  std::vector<Sample> samples_;
+  std::vector<Sample> batch_;  // replayed batch being published
+  std::unique_ptr<OutboundQueue> outbox_;
+  uint32_t replay_interval_ms_{0};
+  uint32_t last_replay_{0};
+  bool connected_{false};
+  std::string buffer_;  // reused between batches to avoid heap churn
+  uint32_t dropped_{0};
+#ifdef USE_TIME
+  time::RealTimeClock *clock_{nullptr};
+#endif
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
+
+#endif  // USE_MQTT
@@ -0,0 +1,258 @@
+#pragma once
+
+#ifdef USE_SCPI_DMM_SPOOL
+#include <LittleFS.h>
+#endif
+#include "esphome/core/log.h"
+#include "sample_codec.h"
+#include "sample_pipeline.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+static const size_t SPOOL_RECORD_HEADER_SIZE = 18;
+#ifdef USE_SCPI_DMM_SPOOL
+// Kept free on the partition so LittleFS can still commit metadata when the spool is full
+static const size_t SPOOL_FS_RESERVE = 4 * 4096;
+#endif
+
+// Store-and-forward queue for samples an output could not deliver. Samples are kept
+// as compressed SampleBlocks in RAM; once memory_bytes is used up the oldest block is
+// spilled to a spool file on LittleFS (when enabled) or dropped. peek() hands samples
+// back oldest first, spool before RAM, so replay keeps the order of acquisition.
+//
+// Spool record (little-endian), repeated:
+//   offset  size  field
+//   0       4     uptime of the first sample in ms
+//   4       4     uptime of the last sample in ms
+//   8       4     first value, float32 bits
+//   12      2     sample count
+//   14      2     bit length of the encoded stream
+//   16      1     function (MeasurementFunction index)
+//   17      1     source (instrument index)
+//   18      n     encoded stream, see SampleBlock (n = ceil(bit length / 8))
+class OutboundQueue {
+ public:
+  explicit OutboundQueue(size_t memory_bytes)
+      : max_blocks_(std::max<size_t>(1, memory_bytes / sizeof(SampleBlock))) {}
+
+#ifdef USE_SCPI_DMM_SPOOL
+  void set_spool(std::string path, size_t max_size) {
+    this->spool_path_ = std::move(path);
+    this->spool_max_size_ = max_size;
+  }
+#endif
+
+  void setup() {
+#ifdef USE_SCPI_DMM_SPOOL
+    if (this->spool_path_.empty())
+      return;
+    if (!LittleFS.begin(true)) {
+      ESP_LOGE("scpi_dmm", "Could not mount LittleFS, outbound queue kept in RAM only");
+      return;
+    }
+    this->spool_mounted_ = true;
+    // Uptime stamps from before the reboot cannot be placed in time any more
+    if (LittleFS.exists(this->spool_path_.c_str())) {
+      ESP_LOGW("scpi_dmm", "Discarding outbound spool %s from the previous boot", this->spool_path_.c_str());
+      LittleFS.remove(this->spool_path_.c_str());
+    }
+    // Whatever else lives on the partition (a data log, say) keeps its space
+    size_t used = LittleFS.usedBytes() + SPOOL_FS_RESERVE;
+    size_t limit = LittleFS.totalBytes() > used ? LittleFS.totalBytes() - used : 0;
+    if (this->spool_max_size_ > limit) {
+      ESP_LOGW("scpi_dmm", "Spool limited to the %u bytes free on LittleFS", (unsigned) limit);
+      this->spool_max_size_ = limit;
+    }
+#endif
+  }
+
+  void add(const Sample &sample) {
+    if (!this->blocks_.empty() && this->encoder_.append(*this->blocks_.back(), sample)) {
+      this->sample_count_++;
+      return;
+    }
+    if (this->blocks_.size() >= this->max_blocks_)
+      this->evict_oldest_();
+    this->blocks_.emplace_back(new SampleBlock());
+    this->encoder_.start(*this->blocks_.back(), sample);
+    this->sample_count_++;
+  }
+
+  bool empty() const { return this->sample_count_ == 0; }
+  size_t get_sample_count() const { return this->sample_count_; }
+  uint32_t get_dropped() const { return this->dropped_; }
+  uint32_t get_spilled() const { return this->spilled_; }
+
+  // Copies up to max of the oldest samples into out (cleared first) without removing
+  // them. They share one function and source and are never more than max_gap_ms apart.
+  size_t peek(std::vector<Sample> &out, size_t max, uint32_t max_gap_ms) {
+    out.clear();
+    if (!this->load_replay_block_())
+      return 0;
+    uint16_t skip = this->replay_offset_;
+    decode_sample_block(*this->replay_block_, [&](const Sample &sample) {
+      if (skip > 0) {
+        skip--;
+        return true;
+      }
+      if (out.size() >= max || (!out.empty() && sample.timestamp_ms - out.back().timestamp_ms > max_gap_ms))
+        return false;
+      out.push_back(sample);
+      return true;
+    });
+    return out.size();
+  }
+
+  // Removes the count samples the last peek() returned, once they were delivered
+  void pop(size_t count) {
+    if (this->replay_block_ == nullptr)
+      return;
+    count = std::min<size_t>(count, this->replay_block_->count - this->replay_offset_);
+    this->replay_offset_ += count;
+    this->sample_count_ -= count;
+    if (this->replay_offset_ >= this->replay_block_->count)
+      this->replay_block_.reset();
+  }
+
+ protected:
+  // Makes replay_block_ the oldest block with samples left; false when the queue is empty
+  bool load_replay_block_() {
+    if (this->replay_block_ != nullptr)
+      return true;
+    this->replay_offset_ = 0;
+#ifdef USE_SCPI_DMM_SPOOL
+    if (this->spool_read_ < this->spool_size_)
+      return this->read_spool_();
+#endif
+    if (this->blocks_.empty())
+      return false;
+    this->replay_block_ = std::move(this->blocks_.front());
+    this->blocks_.pop_front();
+    return true;
+  }
+
+  void evict_oldest_() {
+    std::unique_ptr<SampleBlock> oldest = std::move(this->blocks_.front());
+    this->blocks_.pop_front();
+#ifdef USE_SCPI_DMM_SPOOL
+    if (this->write_spool_(*oldest))
+      return;
+#endif
+    this->sample_count_ -= oldest->count;
+    this->dropped_ += oldest->count;
+  }
+
+#ifdef USE_SCPI_DMM_SPOOL
+  bool write_spool_(const SampleBlock &block) {
+    size_t size = SPOOL_RECORD_HEADER_SIZE + block.data_bytes();
+    if (!this->spool_mounted_ || this->spool_size_ + size > this->spool_max_size_)
+      return false;
+    uint8_t header[SPOOL_RECORD_HEADER_SIZE];
+    put_le_(header, block.first_ms, 4);
+    put_le_(header + 4, block.last_ms, 4);
+    put_le_(header + 8, block.first_bits, 4);
+    put_le_(header + 12, block.count, 2);
+    put_le_(header + 14, block.bit_length, 2);
+    header[16] = static_cast<uint8_t>(block.function);
+    header[17] = block.source;
+    fs::File file = LittleFS.open(this->spool_path_.c_str(), FILE_APPEND);
+    if (!file)
+      return false;
+    size_t written = file.write(header, sizeof(header));
+    written += file.write(block.data, block.data_bytes());
+    file.close();
+    if (written != size) {
+      ESP_LOGW("scpi_dmm", "Short write to %s, flash full?", this->spool_path_.c_str());
+      return false;
+    }
+    this->spool_size_ += size;
+    this->spilled_++;
+    return true;
+  }
+
+  bool read_spool_() {
+    fs::File file = LittleFS.open(this->spool_path_.c_str(), FILE_READ);
+    uint8_t header[SPOOL_RECORD_HEADER_SIZE];
+    std::unique_ptr<SampleBlock> block(new SampleBlock());
+    bool ok = file && file.seek(this->spool_read_) && file.read(header, sizeof(header)) == sizeof(header);
+    if (ok) {
+      block->first_ms = get_le_(header, 4);
+      block->last_ms = get_le_(header + 4, 4);
+      block->first_bits = get_le_(header + 8, 4);
+      block->count = get_le_(header + 12, 2);
+      block->bit_length = get_le_(header + 14, 2);
+      block->function = static_cast<MeasurementFunction>(header[16]);
+      block->source = header[17];
+      ok = block->data_bytes() <= SAMPLE_BLOCK_BYTES &&
+           file.read(block->data, block->data_bytes()) == block->data_bytes();
+    }
+    if (file)
+      file.close();
+    if (!ok) {
+      // Whatever is left of the spool cannot be trusted; the counts go with it
+      ESP_LOGW("scpi_dmm", "Could not read %s, dropping the spooled samples", this->spool_path_.c_str());
+      this->reset_spool_();
+      return this->load_replay_block_();
+    }
+    this->spool_read_ += SPOOL_RECORD_HEADER_SIZE + block->data_bytes();
+    this->spilled_--;
+    this->replay_block_ = std::move(block);
+    if (this->spool_read_ >= this->spool_size_)
+      this->reset_spool_();
+    return true;
+  }
+
+  void reset_spool_() {
+    LittleFS.remove(this->spool_path_.c_str());
+    this->spool_size_ = 0;
+    this->spool_read_ = 0;
+    if (this->spilled_ > 0) {
+      // Samples of records that were never read back
+      size_t ram = 0;
+      for (const auto &block : this->blocks_)
+        ram += block->count;
+      if (this->replay_block_ != nullptr)
+        ram += this->replay_block_->count - this->replay_offset_;
+      this->dropped_ += this->sample_count_ - ram;
+      this->sample_count_ = ram;
+      this->spilled_ = 0;
+    }
+  }
+
+  static uint32_t get_le_(const uint8_t *in, size_t bytes) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+      value |= uint32_t(in[i]) << (8 * i);
+    return value;
+  }
+
+  static void put_le_(uint8_t *out, uint32_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+      out[i] = (value >> (8 * i)) & 0xFF;
+  }
+
+  std::string spool_path_;
+  size_t spool_max_size_{0};
+  bool spool_mounted_{false};
+  size_t spool_size_{0};  // bytes appended since the spool was last emptied
+  size_t spool_read_{0};  // bytes already replayed
+#endif
+
+  size_t max_blocks_;
+  std::deque<std::unique_ptr<SampleBlock>> blocks_;  // oldest first, the last one open
+  SampleBlockEncoder encoder_;                       // state of blocks_.back()
+  std::unique_ptr<SampleBlock> replay_block_;        // block peek() is reading from
+  uint16_t replay_offset_{0};                        // samples of it already popped
+  size_t sample_count_{0};                           // samples waiting, RAM and spool
+  uint32_t dropped_{0};
+  uint32_t spilled_{0};  // blocks currently on the spool
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
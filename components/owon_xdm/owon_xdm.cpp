@@ -2,12 +2,274 @@
 #include "esphome/core/log.h"
 
 namespace esphome {
-namespace owon_xdm {
+namespace scpi_dmm {
 
-static const char *TAG = "owon_xdm";
+static const char *TAG = "scpi_dmm";
 
-// Nothing needed here for now - core functionality is in the header
-// We'll expand this as needed for more complex parsing logic
+#ifdef USE_SCPI_DMM_HTTP
+std::string SCPIDMMWebHandler::route_(AsyncWebServerRequest *request) const {
+  std::string url = request->url().c_str();
+  if (url.compare(0, this->prefix_.size(), this->prefix_) != 0)
+    return "";
+  return url.substr(this->prefix_.size());
+}
 
-}  // namespace owon_xdm
+bool SCPIDMMWebHandler::canHandle(AsyncWebServerRequest *request) const {
+  std::string url = this->route_(request);
+  return url == "/history" || url == "/stream" || url == "/metrics" || url == "/log";
+}
+
+void SCPIDMMWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  std::string url = this->route_(request);
+  if (url == "/history") {
+    this->handle_history_(request);
+    return;
+  }
+#ifdef USE_SCPI_DMM_LIVE_STREAM
+  if (url == "/stream") {
+    this->handle_stream_(request);
+    return;
+  }
+#endif
+  if (url == "/metrics") {
+    this->handle_metrics_(request);
+    return;
+  }
+#ifdef USE_SCPI_DMM_DATALOG
+  if (url == "/log") {
+    this->handle_log_(request);
+    return;
+  }
+#endif
+  request->send(404);
+}
+
+void SCPIDMMWebHandler::handle_history_(AsyncWebServerRequest *request) {
+  HistoryRing *history = this->parent_->get_history();
+  if (history == nullptr) {
+    request->send(404, "text/plain", "History is not enabled");
+    return;
+  }
+  const uint32_t now = millis();
+  auto arg = [request](const char *name, int64_t fallback) -> int64_t {
+    if (!request->hasArg(name))
+      return fallback;
+    return strtoll(request->arg(name).c_str(), nullptr, 10);
+  };
+  uint32_t from = resolve_history_time(arg("from", 0), now);
+  uint32_t to = resolve_history_time(arg("to", -1), now);
+  uint32_t bucket = arg("bucket", 0);
+  size_t limit = arg("limit", 2000);
+
+  AsyncResponseStream *stream = request->beginResponseStream("application/json");
+  stream->printf("{\"now\":%u", (unsigned) now);
+  if (bucket > 0) {
+    stream->print(",\"buckets\":[");
+    bool first = true;
+    history->summarize(from, to, bucket, [&](const HistorySummary &summary) {
+      stream->printf("%s[%u,\"%s\",%u,%g,%g,%g]", first ? "" : ",", (unsigned) summary.start_ms,
+                     function_to_string(summary.function), (unsigned) summary.count, summary.min, summary.max,
+                     summary.mean);
+      first = false;
+    });
+  } else {
+    stream->print(",\"samples\":[");
+    bool first = true;
+    history->query(from, to, limit, [&](const Sample &sample) {
+      stream->printf("%s[%u,%g,\"%s\"]", first ? "" : ",", (unsigned) sample.timestamp_ms, sample.value,
+                     function_to_string(sample.function));
+      first = false;
+    });
+  }
+  stream->print("]}");
+  request->send(stream);
+}
+#ifdef USE_SCPI_DMM_LIVE_STREAM
+void SCPIDMMWebHandler::handle_stream_(AsyncWebServerRequest *request) {
+  LiveStream *stream = this->parent_->get_live_stream();
+  if (stream == nullptr) {
+    request->send(404, "text/plain", "Live stream is not enabled");
+    return;
+  }
+  std::shared_ptr<LiveStreamClient> client = stream->connect();
+  if (client == nullptr) {
+    request->send(503, "text/plain", "Too many stream clients");
+    return;
+  }
+  ESP_LOGD(TAG, "Stream client connected (%u active)", (unsigned) stream->get_client_count());
+  // The filler is pulled whenever the connection can take more data, so a slow client
+  // only delays itself. The client cursor lives as long as the response.
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      "text/event-stream", [client](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+        size_t written = client->stream->fill(*client, buffer, max_len);
+        return written == 0 ? RESPONSE_TRY_AGAIN : written;
+      });
+  response->addHeader("Cache-Control", "no-cache");
+  response->addHeader("Access-Control-Allow-Origin", "*");
+  request->send(response);
+}
+#endif
+void SCPIDMMWebHandler::handle_metrics_(AsyncWebServerRequest *request) {
+  static const char *const PRIORITY_NAMES[PRIORITY_COUNT] = {"interactive", "configuration", "measurement",
+                                                             "housekeeping"};
+  Metrics *metrics = this->parent_->get_metrics();
+  const uint32_t now = millis();
+  // Everything is printed straight into the response, no intermediate strings
+  AsyncResponseStream *stream = request->beginResponseStream("text/plain; version=0.0.4");
+  {
+    LockGuard guard(metrics->lock());
+
+    stream->print("# HELP scpi_dmm_reading Latest reading per measurement function\n"
+                  "# TYPE scpi_dmm_reading gauge\n");
+    for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+      const FunctionStats &stats = metrics->get_function(i);
+      if (stats.count > 0)
+        stream->printf("scpi_dmm_reading{function=\"%s\"} %g\n",
+                       function_to_string(static_cast<MeasurementFunction>(i)), stats.last);
+    }
+    stream->print("# HELP scpi_dmm_reading_age_seconds Time since the latest reading\n"
+                  "# TYPE scpi_dmm_reading_age_seconds gauge\n");
+    for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+      const FunctionStats &stats = metrics->get_function(i);
+      if (stats.count > 0)
+        stream->printf("scpi_dmm_reading_age_seconds{function=\"%s\"} %.3f\n",
+                       function_to_string(static_cast<MeasurementFunction>(i)), (now - stats.last_ms) / 1000.0f);
+    }
+    stream->print("# HELP scpi_dmm_readings Readings per measurement function since boot\n"
+                  "# TYPE scpi_dmm_readings summary\n");
+    for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+      const FunctionStats &stats = metrics->get_function(i);
+      if (stats.count == 0)
+        continue;
+      const char *function = function_to_string(static_cast<MeasurementFunction>(i));
+      stream->printf("scpi_dmm_readings_count{function=\"%s\"} %u\n", function, (unsigned) stats.count);
+      stream->printf("scpi_dmm_readings_sum{function=\"%s\"} %g\n", function, stats.sum);
+    }
+    stream->print("# TYPE scpi_dmm_reading_min gauge\n");
+    for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+      const FunctionStats &stats = metrics->get_function(i);
+      if (stats.count > 0)
+        stream->printf("scpi_dmm_reading_min{function=\"%s\"} %g\n",
+                       function_to_string(static_cast<MeasurementFunction>(i)), stats.min);
+    }
+    stream->print("# TYPE scpi_dmm_reading_max gauge\n");
+    for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+      const FunctionStats &stats = metrics->get_function(i);
+      if (stats.count > 0)
+        stream->printf("scpi_dmm_reading_max{function=\"%s\"} %g\n",
+                       function_to_string(static_cast<MeasurementFunction>(i)), stats.max);
+    }
+
+    const LatencyHistogram &latency = metrics->get_latency();
+    stream->print("# HELP scpi_dmm_query_latency_seconds Round trip of answered queries\n"
+                  "# TYPE scpi_dmm_query_latency_seconds histogram\n");
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+      cumulative += latency.buckets[i];
+      stream->printf("scpi_dmm_query_latency_seconds_bucket{le=\"%g\"} %u\n", LATENCY_BUCKETS_MS[i] / 1000.0f,
+                     (unsigned) cumulative);
+    }
+    stream->printf("scpi_dmm_query_latency_seconds_bucket{le=\"+Inf\"} %u\n", (unsigned) latency.count);
+    stream->printf("scpi_dmm_query_latency_seconds_sum %.3f\n", latency.sum_ms / 1000.0);
+    stream->printf("scpi_dmm_query_latency_seconds_count %u\n", (unsigned) latency.count);
+
+    stream->printf("# TYPE scpi_dmm_query_timeouts_total counter\nscpi_dmm_query_timeouts_total %u\n",
+                   (unsigned) metrics->get_timeouts());
+    stream->printf("# TYPE scpi_dmm_unsolicited_total counter\nscpi_dmm_unsolicited_total %u\n",
+                   (unsigned) metrics->get_unsolicited());
+    stream->printf("# TYPE scpi_dmm_invalid_replies_total counter\nscpi_dmm_invalid_replies_total %u\n",
+                   (unsigned) metrics->get_invalid());
+
+    stream->print("# HELP scpi_dmm_commands_total Commands sent per scheduling class\n"
+                  "# TYPE scpi_dmm_commands_total counter\n");
+    for (size_t i = 0; i < PRIORITY_COUNT; i++)
+      stream->printf("scpi_dmm_commands_total{priority=\"%s\"} %u\n", PRIORITY_NAMES[i],
+                     (unsigned) metrics->get_scheduler(i).dispatched);
+    stream->print("# HELP scpi_dmm_commands_dropped_total Commands rejected by a full queue\n"
+                  "# TYPE scpi_dmm_commands_dropped_total counter\n");
+    for (size_t i = 0; i < PRIORITY_COUNT; i++)
+      stream->printf("scpi_dmm_commands_dropped_total{priority=\"%s\"} %u\n", PRIORITY_NAMES[i],
+                     (unsigned) metrics->get_scheduler(i).dropped);
+    stream->print("# HELP scpi_dmm_command_wait_seconds Queueing delay per scheduling class\n"
+                  "# TYPE scpi_dmm_command_wait_seconds summary\n");
+    for (size_t i = 0; i < PRIORITY_COUNT; i++) {
+      const PriorityStats &stats = metrics->get_scheduler(i);
+      stream->printf("scpi_dmm_command_wait_seconds_sum{priority=\"%s\"} %.3f\n", PRIORITY_NAMES[i],
+                     stats.total_wait_ms / 1000.0);
+      stream->printf("scpi_dmm_command_wait_seconds_count{priority=\"%s\"} %u\n", PRIORITY_NAMES[i],
+                     (unsigned) stats.dispatched);
+    }
+    stream->print("# TYPE scpi_dmm_command_wait_seconds_max gauge\n");
+    for (size_t i = 0; i < PRIORITY_COUNT; i++)
+      stream->printf("scpi_dmm_command_wait_seconds_max{priority=\"%s\"} %.3f\n", PRIORITY_NAMES[i],
+                     metrics->get_scheduler(i).max_wait_ms / 1000.0f);
+
+    if (metrics->has_clock()) {
+      const ClockStats &clock = metrics->get_clock();
+      stream->print("# HELP scpi_dmm_clock_jitter_seconds Delay of clocked queries behind their grid time\n"
+                    "# TYPE scpi_dmm_clock_jitter_seconds summary\n");
+      stream->printf("scpi_dmm_clock_jitter_seconds_sum %.6f\n", clock.jitter_sum_us / 1e6);
+      stream->printf("scpi_dmm_clock_jitter_seconds_count %u\n", (unsigned) clock.samples);
+      stream->printf("# TYPE scpi_dmm_clock_jitter_seconds_max gauge\nscpi_dmm_clock_jitter_seconds_max %.6f\n",
+                     clock.jitter_max_us / 1e6);
+      stream->printf("# TYPE scpi_dmm_clock_missed_ticks_total counter\nscpi_dmm_clock_missed_ticks_total %u\n",
+                     (unsigned) clock.missed);
+    }
+  }
+
+  HistoryRing *history = this->parent_->get_history();
+  if (history != nullptr)
+    stream->printf("# TYPE scpi_dmm_history_samples gauge\nscpi_dmm_history_samples %u\n",
+                   (unsigned) history->get_sample_count());
+  LinkState link = this->parent_->get_link_state();
+  stream->print("# HELP scpi_dmm_link_state Meter link state, 1 for the current one\n"
+                "# TYPE scpi_dmm_link_state gauge\n");
+  for (size_t i = 0; i < LINK_STATE_COUNT; i++) {
+    LinkState state = static_cast<LinkState>(i);
+    stream->printf("scpi_dmm_link_state{state=\"%s\"} %u\n", link_state_to_string(state), state == link ? 1u : 0u);
+  }
+  stream->printf("# TYPE scpi_dmm_baud_rate gauge\nscpi_dmm_baud_rate %u\n", (unsigned) this->parent_->get_baud_rate());
+  stream->printf("# HELP scpi_dmm_power_cycles_total Meter power-ups detected on the link\n"
+                 "# TYPE scpi_dmm_power_cycles_total counter\nscpi_dmm_power_cycles_total %u\n",
+                 (unsigned) this->parent_->get_soft_starts());
+  TriggerInput *trigger = this->parent_->get_trigger_input();
+  if (trigger != nullptr) {
+    stream->printf("# TYPE scpi_dmm_trigger_edges_total counter\nscpi_dmm_trigger_edges_total %u\n",
+                   (unsigned) trigger->get_edges());
+    stream->printf("# TYPE scpi_dmm_trigger_missed_total counter\nscpi_dmm_trigger_missed_total %u\n",
+                   (unsigned) trigger->get_missed());
+  }
+  LiveStream *live = this->parent_->get_live_stream();
+  if (live != nullptr)
+    stream->printf("# TYPE scpi_dmm_stream_clients gauge\nscpi_dmm_stream_clients %u\n",
+                   (unsigned) live->get_client_count());
+#ifdef USE_MQTT
+  MQTTSampleStream *mqtt_stream = this->parent_->get_mqtt_stream();
+  if (mqtt_stream != nullptr)
+    stream->printf("# TYPE scpi_dmm_mqtt_dropped_total counter\nscpi_dmm_mqtt_dropped_total %u\n"
+                   "# TYPE scpi_dmm_mqtt_backlog_samples gauge\nscpi_dmm_mqtt_backlog_samples %u\n",
+                   (unsigned) mqtt_stream->get_dropped(), (unsigned) mqtt_stream->get_backlog());
+#endif
+  request->send(stream);
+}
+
+#ifdef USE_SCPI_DMM_DATALOG
+void SCPIDMMWebHandler::handle_log_(AsyncWebServerRequest *request) {
+  FlashLogger *logger = this->parent_->get_datalog();
+  if (logger == nullptr) {
+    request->send(404, "text/plain", "Data logging is not enabled");
+    return;
+  }
+  // Samples still in the RAM page buffer are not part of the download until the next flush
+  const std::string &path = request->hasArg("rotated") ? logger->get_rotated_path() : logger->get_path();
+  if (!LittleFS.exists(path.c_str())) {
+    request->send(404, "text/plain", "No log file");
+    return;
+  }
+  request->send(LittleFS, path.c_str(), "application/octet-stream", true);
+}
+#endif
+#endif  // USE_SCPI_DMM_HTTP
+
+}  // namespace scpi_dmm
 }  // namespace esphome
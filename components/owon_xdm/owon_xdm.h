@@ -8,8 +8,33 @@
 #include "esphome/components/button/button.h"
 #include "esphome/components/api/custom_api_device.h"
 #include "esphome/core/helpers.h"
-#include <regex>
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "baud_rate.h"
+#include "calibration.h"
+#include "command_scheduler.h"
+#include "datalog.h"
+#include "derived_channel.h"
+#include "device_detect.h"
+#include "history.h"
+#include "live_stream.h"
+#include "metrics.h"
+#include "reading_parser.h"
+#include "response_framer.h"
+#include "rx_source.h"
+#include "sample_clock.h"
+#include "mqtt_bridge.h"
+#include "mqtt_stream.h"
+#include "sample_pipeline.h"
+#include "trigger.h"
+#include "warm_state.h"
+#include "watchdog.h"
+#include "web_handler.h"
 #include <map>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
 
 namespace esphome {
 namespace scpi_dmm {
@@ -53,6 +78,31 @@ struct DeviceCommands {
     std::string remote_enable{"SYST:REM"};
     std::string fast_mode{""};
     std::vector<std::string> init_commands{};
+    // State writes and cheap state queries; empty means unsupported
+    std::string select_function{"CONF:"};  // followed by the function mnemonic
+    std::string query_function{"FUNC?"};
+    std::string select_range{"RANGE "};
+    std::string query_range{""};
+    std::string auto_range_on{""};
+    std::string auto_range_off{""};
+    std::string query_auto_range{""};
+    std::string select_rate{""};          // followed by the rate code
+    std::string query_rate{""};
+    std::string dual_on{""};
+    std::string dual_off{""};
+    // Buffered acquisition: buffer_start arms continuous triggering into reading memory,
+    // buffer_fetch drains it. Empty buffer_fetch means one MEAS? round trip per reading.
+    std::string buffer_start{""};
+    std::string buffer_fetch{""};
+    // Payload of definite-length block replies, must match the FORM:DATA sent in buffer_start
+    ReadingFormat reading_format{ReadingFormat::ASCII};
+    // Bytes the meter emits when it powers up, empty if it is silent. On a match the
+    // reinit commands are sent (no reset, the meter is at its defaults already) and
+    // the cached function, range and rate are restored.
+    std::string soft_start_pattern{""};
+    std::vector<std::string> reinit_commands{};
+    // Sets the serial rate, followed by the rate; empty if it can only be set on the meter
+    std::string select_baud{""};
 };
 
 // Device-specific command sets
@@ -61,7 +111,20 @@ static const std::map<std::string, DeviceCommands> DEVICE_COMMANDS = {
         .measure_voltage_dc = "MEAS:VOLT?",
         .measure_current_dc = "MEAS:CURR?",
         .fast_mode = "RATE F",
-        .init_commands = {"RATE F", "RATE?"}
+        .init_commands = {"RATE F", "RATE?"},
+        .select_function = "FUNC1 ",
+        .query_function = "FUNC1?",
+        .select_range = "RANGE ",
+        .query_range = "RANGE?",
+        .auto_range_on = "AUTO ON",
+        .auto_range_off = "AUTO OFF",
+        .query_auto_range = "AUTO?",
+        .select_rate = "RATE ",
+        .query_rate = "RATE?",
+        .dual_on = "DUAL ON",
+        .dual_off = "DUAL OFF",
+        // Powers up in slow rate; the rate is restored from the cache, or fast_mode
+        .soft_start_pattern = std::string("\x00\x01\x00", 3)
     }},
     {"KEYSIGHT_34460A", DeviceCommands{
         .init_commands = {
@@ -69,23 +132,63 @@ static const std::map<std::string, DeviceCommands> DEVICE_COMMANDS = {
             "SENS:VOLT:DC:NPLC 0.02",
             "TRIG:SOUR IMM",
             "TRIG:COUN INF"
-        }
+        },
+        // CONF resets the trigger count, so re-arm after every switch. REAL,32 makes
+        // R? and MEAS? answer with binary blocks, 4 bytes per reading instead of ~16.
+        .buffer_start = "FORM:DATA REAL,32;:TRIG:SOUR IMM;:TRIG:COUN INF;:INIT",
+        .buffer_fetch = "R? 200",
+        .reading_format = ReadingFormat::REAL32
     }},
     // Add more device-specific commands here
 };
 
-enum class MeasurementFunction {
-  VOLTAGE_DC,
-  VOLTAGE_AC,
-  CURRENT_DC,
-  CURRENT_AC,
-  RESISTANCE,
-  CONTINUITY,
-  DIODE,
-  FREQUENCY,
-  TEMPERATURE,
-  CAPACITANCE,
-  UNKNOWN
+// Cached instrument configuration. Empty strings and -1 mean unknown.
+struct InstrumentState {
+  MeasurementFunction function{MeasurementFunction::UNKNOWN};
+  std::string range;
+  std::string rate;  // "F", "M" or "S" on the XDM
+  int8_t auto_range{-1};
+  int8_t dual{-1};
+};
+
+// One step of an on-device measurement sequence
+struct SequenceStep {
+  std::string function_command;  // e.g. "FUNC1 VOLT:DC"
+  std::string range_command;     // optional, e.g. "RANGE 50V"
+  uint32_t settle_ms{0};         // wait after switching before the first query
+  uint8_t skip{0};               // readings to discard once settled
+  uint8_t readings{1};           // readings averaged into the step result
+};
+
+struct SequenceResult {
+  MeasurementFunction function;
+  float value;
+  uint8_t count;
+};
+
+// Function/range switch transaction: wait for the in-flight query, send the change,
+// wait the learned settle time, then poll until two consecutive readings agree
+enum class SwitchState : uint8_t {
+  IDLE,
+  QUIESCE,
+  SETTLE,
+  VALIDATE
+};
+
+// Baud rate change: send the command, follow once it is out (CHANGE), give the meter
+// time to switch (SETTLE), then require a burst of identical *IDN? replies (VERIFY)
+enum class BaudState : uint8_t {
+  IDLE,
+  CHANGE,
+  SETTLE,
+  VERIFY
+};
+
+enum class SequenceState : uint8_t {
+  IDLE,
+  APPLY,
+  SETTLE,
+  MEASURE
 };
 
 class SCPIDMM : public Component, public uart::UARTDevice, public api::CustomAPIDevice {
@@ -101,6 +204,7 @@ class SCPIDMM : public Component, public uart::UARTDevice, public api::CustomAPI
   text_sensor::TextSensor *range_sensor{nullptr};
   text_sensor::TextSensor *status_sensor{nullptr};
   text_sensor::TextSensor *idn_sensor{nullptr};
+  text_sensor::TextSensor *sequence_sensor{nullptr};  // One JSON document per finished sequence step
 
   // Control components
   select::Select *function_select{nullptr};
@@ -113,8 +217,9 @@ class SCPIDMM : public Component, public uart::UARTDevice, public api::CustomAPI
   void set_secondary_value_sensor(sensor::Sensor *sensor) { this->secondary_value_sensor = sensor; }
   void set_function_sensor(text_sensor::TextSensor *sensor) { this->function_sensor = sensor; }
   void set_range_sensor(text_sensor::TextSensor *sensor) { this->range_sensor = sensor; }
-  void set_status_sensor(text_sensor::TextSensor *sensor) { this->status_sensor = status_sensor; }
-  void set_idn_sensor(text_sensor::TextSensor *sensor) { this->idn_sensor = idn_sensor; }
+  void set_status_sensor(text_sensor::TextSensor *sensor) { this->status_sensor = sensor; }
+  void set_idn_sensor(text_sensor::TextSensor *sensor) { this->idn_sensor = sensor; }
+  void set_sequence_sensor(text_sensor::TextSensor *sensor) { this->sequence_sensor = sensor; }
   
   void set_function_select(select::Select *select) { 
     this->function_select = select; 
@@ -138,93 +243,512 @@ class SCPIDMM : public Component, public uart::UARTDevice, public api::CustomAPI
   }
 
   void setup() override {
+    this->query_.set_on_complete(
+        [this](bool answered, uint32_t elapsed_ms) { this->on_query_complete_(answered, elapsed_ms); });
     // Register services for Home Assistant integration
-    register_service(&SCPIDMM::on_relative_zero, "relative_zero");
-    register_service(&SCPIDMM::on_reset, "reset");
-    register_service(&SCPIDMM::on_set_function, "set_function", {"function"});
-    register_service(&SCPIDMM::on_set_range, "set_range", {"mode"});
-    register_service(&SCPIDMM::on_set_rate, "set_rate", {"mode"});
-    // Query device identification
-    this->write_str("*IDN?\r\n");
-    
-    // Reset to known state
-    this->write_str("*RST\r\n");
-    
-    // Set to remote mode if supported
-    this->write_str("SYST:REM\r\n");
+    register_service(&SCPIDMM::on_relative_zero, this->service_name_("relative_zero"));
+    register_service(&SCPIDMM::on_clear_relative_zero, this->service_name_("clear_relative_zero"));
+    register_service(&SCPIDMM::on_reset, this->service_name_("reset"));
+    register_service(&SCPIDMM::on_set_function, this->service_name_("set_function"), {"function"});
+    register_service(&SCPIDMM::on_set_range, this->service_name_("set_range"), {"mode"});
+    register_service(&SCPIDMM::on_set_rate, this->service_name_("set_rate"), {"mode"});
+    register_service(&SCPIDMM::on_set_sequence, this->service_name_("set_sequence"), {"sequence"});
+    register_service(&SCPIDMM::on_start_sequence, this->service_name_("start_sequence"));
+    register_service(&SCPIDMM::on_stop_sequence, this->service_name_("stop_sequence"));
+    register_service(&SCPIDMM::on_send_command, this->service_name_("send_command"), {"command"});
+    if (this->history_ != nullptr)
+      register_service(&SCPIDMM::on_query_history, this->service_name_("query_history"), {"start_ms", "end_ms", "bucket_ms"});
+
+    this->add_sink_([this](const Sample &sample) { this->metrics_.add_sample(sample); });
+    if (this->auto_detect_)
+      this->load_profile_();
+    this->setup_rx_();
+    this->soft_start_.set_pattern(this->commands_.soft_start_pattern);
+    if (this->status_sensor != nullptr)
+      this->status_sensor->publish_state(link_state_to_string(this->watchdog_.get_state()));
+    if (this->trigger_input_ != nullptr)
+      this->trigger_input_->setup();
+    if (this->trigger_output_ != nullptr)
+      this->trigger_output_->setup();
+    if (this->sample_clock_enabled_) {
+      this->sample_clock_.start(this->query_interval_);
+      ESP_LOGCONFIG("scpi_dmm", "Sample clock every %u ms (%s)", (unsigned) this->query_interval_,
+                    this->sample_clock_.is_hardware() ? "esp_timer" : "software");
+    }
+
+    // A full sweep of the rates if the meter does not answer at the configured one
+    if (this->baud_autodetect_ && this->baud_rates_.size() > 0)
+      this->detect_left_ = this->baud_rates_.size() - 1;
+
+    // Query device identification; with auto-detection this also verifies the cached profile
+    this->enqueue_(this->commands_.identify, ResponseKind::RAW, CommandPriority::CONFIGURATION,
+                   [this](bool ok, const std::string &response) { this->on_identify_(ok, response); });
+
+    bool warm = this->load_warm_state_();
+    // While the rate is still being detected anything queued behind *IDN? could go out at
+    // the wrong one; the boot commands then wait for a valid reply
+    if (this->detect_left_ > 0) {
+      this->init_pending_ = true;
+    } else {
+      this->send_init_commands_(warm);
+    }
+
+#ifdef USE_SCPI_DMM_HTTP
+    web_server_base::global_web_server_base->init();
+    web_server_base::global_web_server_base->add_handler(new SCPIDMMWebHandler(this, this->route_prefix_()));
+#endif
+
+#ifdef USE_SCPI_DMM_DATALOG
+    if (this->datalog_ != nullptr) {
+#ifdef USE_TIME
+      this->datalog_->set_time(this->clock_);
+#endif
+      this->datalog_->setup();
+    }
+#endif
+
+#ifdef USE_MQTT
+    if (this->mqtt_bridge_ != nullptr) {
+      this->mqtt_bridge_->set_default_topics(this->mqtt_topic_base_());
+      this->mqtt_bridge_->setup();
+    }
+#ifdef USE_TIME
+    if (this->mqtt_stream_ != nullptr)
+      this->mqtt_stream_->set_time(this->clock_);
+#endif
+    if (this->mqtt_stream_ != nullptr) {
+      this->mqtt_stream_->set_default_topic(this->mqtt_topic_base_() + "/samples");
+      this->mqtt_stream_->setup();
+    }
+#endif
+
+    // Validate the (still unknown) state cache right away
+    this->last_state_poll_ = millis() - this->state_poll_interval_;
+
+    if (this->sequence_autostart_ && !this->sequence_.empty()) {
+      this->start_sequence();
+    }
   }
 
   void loop() override {
-    while (this->available()) {
-      uint8_t c;
-      this->read_byte(&c);
-      
-      if (c == '\n') {
-        if (this->rx_buffer_.length() > 0) {
-          this->handle_response_(this->rx_buffer_);
-          this->rx_buffer_.clear();
-        }
-      } else if (c != '\r') {
-        this->rx_buffer_ += (char) c;
-      }
+    uint8_t buffer[RX_CHUNK_SIZE];
+    size_t count;
+    while (this->rx_->ready() && (count = this->rx_->read(buffer, sizeof(buffer))) > 0) {
+      this->rx_activity_at_ = millis();
+      for (size_t i = 0; i < count; i++)
+        this->receive_byte_(buffer[i]);
     }
 
-    // Periodically query measurements
-    if (millis() - last_query_ >= query_interval_) {
-      query_measurement_();
-      last_query_ = millis();
+    // Give up on a query the meter never answered; long replies count as long as bytes keep coming
+    if (this->query_pending_() && millis() - this->query_.sent_at() >= response_timeout_ &&
+        millis() - this->rx_activity_at_ >= response_timeout_) {
+      ESP_LOGV("scpi_dmm", "Query timed out");
+      this->abandon_query_();
     }
+
+    this->produce_commands_();
+    this->dispatch_();
+
+    if (millis() - this->last_metrics_update_ >= METRICS_UPDATE_INTERVAL) {
+      this->last_metrics_update_ = millis();
+      this->metrics_.update_scheduler(this->scheduler_);
+      this->metrics_.update_clock(this->sample_clock_);
+      this->save_warm_state_();
+    }
+
+#ifdef USE_SCPI_DMM_DATALOG
+    if (this->datalog_ != nullptr)
+      this->datalog_->loop();
+#endif
+#ifdef USE_MQTT
+    if (this->mqtt_bridge_ != nullptr)
+      this->mqtt_bridge_->loop();
+    if (this->mqtt_stream_ != nullptr)
+      this->mqtt_stream_->loop();
+#endif
   }
 
-  // Send SCPI command
-  void send_command(const std::string &cmd) {
-    this->write_str(cmd + "\r\n");
+  void on_shutdown() override {
+    this->save_warm_state_();
+#ifdef USE_SCPI_DMM_DATALOG
+    if (this->datalog_ != nullptr)
+      this->datalog_->flush();
+#endif
   }
 
-  // Set measurement function
-  void set_function(const std::string &function) {
-    this->send_command(function);
-    current_function_ = parse_function_(function);
-    if (this->function_sensor != nullptr) {
-      this->function_sensor->publish_state(function);
+  // Replaces the UART as the source of received bytes, e.g. with a BufferRxSource on
+  // the host. Call before setup().
+  void set_rx_source(RxSource *source) { this->rx_ = source; }
+  // Let UART interrupts signal received data instead of polling the driver (ESP-IDF only)
+  void set_rx_events(bool rx_events) { this->rx_events_ = rx_events; }
+
+  // Shares one pipeline between several meters on the node. Samples carry the source
+  // index and a common millis() timebase. Call before anything that subscribes to it.
+  void set_pipeline(SamplePipeline *pipeline) { this->pipeline_ = pipeline; }
+  SamplePipeline *get_pipeline() { return this->pipeline_; }
+  // Index of this meter in Sample::source, 0 for the first
+  void set_source(uint8_t source) { this->source_ = source; }
+  uint8_t get_source() const { return this->source_; }
+  void set_query_interval(uint32_t interval_ms) { this->query_interval_ = interval_ms; }
+  // Poll on a fixed query_interval grid instead of query_interval after the previous poll
+  void set_sample_clock(bool enabled) { this->sample_clock_enabled_ = enabled; }
+  const SampleClock &get_sample_clock() const { return this->sample_clock_; }
+
+  // Take a reading on each edge of pin instead of polling; on buffered meters an edge
+  // re-arms the reading memory, starting a new batch
+  void set_trigger_input(InternalGPIOPin *pin, gpio::InterruptType edge) {
+    this->trigger_input_ = std::unique_ptr<TriggerInput>(new TriggerInput(pin, edge));
+  }
+  TriggerInput *get_trigger_input() { return this->trigger_input_.get(); }
+  void set_watchdog(uint8_t offline_after, uint32_t probe_min_ms, uint32_t probe_max_ms) {
+    this->watchdog_.set_offline_after(offline_after);
+    this->watchdog_.set_probe_interval(probe_min_ms, probe_max_ms);
+  }
+  LinkState get_link_state() const { return this->watchdog_.get_state(); }
+  // Rates the meter may be set to. With autodetect a missing or garbled *IDN? reply
+  // moves on to the next one; with negotiate the fastest rate passing verify_count
+  // identical *IDN? replies is switched to, if the profile or set_baud_command() has a command.
+  void set_baud_rates(const std::vector<uint32_t> &rates, bool autodetect, bool negotiate, uint8_t verify_count) {
+    this->baud_rates_.set(rates);
+    this->baud_autodetect_ = autodetect;
+    this->baud_negotiate_ = negotiate;
+    this->baud_verify_count_ = verify_count;
+  }
+  void set_baud_command(const std::string &command) { this->baud_command_override_ = command; }
+  uint32_t get_baud_rate() const { return this->parent_->get_baud_rate(); }
+  uint32_t get_soft_starts() const { return this->soft_starts_; }
+  // Pulse pin whenever a reading or a batch is requested from the meter
+  void set_trigger_output(GPIOPin *pin, uint32_t pulse_us) {
+    this->trigger_output_ = std::unique_ptr<TriggerOutput>(new TriggerOutput(pin, pulse_us));
+  }
+
+  // Keep a compressed history of every reading in memory_bytes of RAM
+  void set_history(size_t memory_bytes) {
+    this->history_ = std::unique_ptr<HistoryRing>(new HistoryRing(memory_bytes));
+    HistoryRing *history = this->history_.get();
+    this->add_sink_([history](const Sample &sample) { history->append(sample); });
+  }
+  HistoryRing *get_history() { return this->history_.get(); }
+
+  // Serve readings to Server-Sent Events clients from a ring of `capacity` samples
+  void set_live_stream(size_t capacity, uint16_t max_batch, uint8_t max_clients) {
+    this->live_stream_ = std::unique_ptr<LiveStream>(new LiveStream(capacity, max_batch, max_clients));
+    LiveStream *stream = this->live_stream_.get();
+    this->add_sink_([stream](const Sample &sample) { stream->push(sample); });
+  }
+  LiveStream *get_live_stream() { return this->live_stream_.get(); }
+
+  // Calibrations applied to readings before they enter the pipeline; an empty range
+  // covers every range of the function
+  void add_linear_calibration(MeasurementFunction function, const std::string &range, float gain, float offset) {
+    this->calibration_.add(function, range, CalibrationTransform::linear(gain, offset));
+  }
+  void add_polynomial_calibration(MeasurementFunction function, const std::string &range,
+                                  const std::vector<float> &coefficients) {
+    this->calibration_.add(function, range, CalibrationTransform::polynomial(coefficients));
+  }
+  void add_table_calibration(MeasurementFunction function, const std::string &range, const std::vector<float> &raw,
+                             const std::vector<float> &calibrated) {
+    this->calibration_.add(function, range, CalibrationTransform::table(raw, calibrated));
+  }
+  // Feed a derived channel from the shared pipeline; its inputs may be any meter
+  void add_derived_channel(DerivedChannel *channel) { channel->attach(this->pipeline_); }
+  Metrics *get_metrics() { return &this->metrics_; }
+
+#ifdef USE_SCPI_DMM_DATALOG
+  // Log every reading to a LittleFS file, see FlashLogger
+  void set_datalog(const std::string &path, size_t max_size, uint32_t flush_interval_ms) {
+    this->datalog_ = std::unique_ptr<FlashLogger>(new FlashLogger(path, max_size, flush_interval_ms));
+    FlashLogger *logger = this->datalog_.get();
+    this->add_sink_([logger](const Sample &sample) { logger->add(sample); });
+  }
+  FlashLogger *get_datalog() { return this->datalog_.get(); }
+#endif
+#ifdef USE_MQTT
+  MQTTSampleStream *get_mqtt_stream() { return this->mqtt_stream_.get(); }
+#endif
+
+#ifdef USE_MQTT
+  void set_mqtt_bridge(const std::string &command_topic, const std::string &response_topic,
+                       const std::string &status_topic) {
+    this->mqtt_bridge_ = std::unique_ptr<MQTTBridge>(new MQTTBridge(
+        command_topic, response_topic, status_topic,
+        [this](const std::string &command, ResponseCallback callback) { this->send_command(command, std::move(callback)); }));
+  }
+
+  void set_mqtt_stream(const std::string &topic, StreamFormat format, uint16_t max_samples, uint32_t max_age_ms) {
+    this->mqtt_stream_ = std::unique_ptr<MQTTSampleStream>(new MQTTSampleStream(topic, format, max_samples, max_age_ms));
+    MQTTSampleStream *stream = this->mqtt_stream_.get();
+    this->add_sink_([stream](const Sample &sample) { stream->add(sample); });
+  }
+  // Call after set_mqtt_stream()
+  void set_mqtt_outbox(size_t memory_bytes, uint32_t replay_interval_ms) {
+    this->mqtt_stream_->set_outbox(memory_bytes, replay_interval_ms);
+  }
+#ifdef USE_SCPI_DMM_SPOOL
+  void set_mqtt_spool(const std::string &path, size_t max_size) {
+    this->mqtt_stream_->get_outbox()->set_spool(path, max_size);
+  }
+#endif
+#endif
+
+#ifdef USE_TIME
+  // Wall-clock source for outputs that carry absolute timestamps
+  void set_time(time::RealTimeClock *clock) { this->clock_ = clock; }
+#endif
+
+  void set_device_type(const std::string &device_type) {
+    std::string key = device_type;
+    std::transform(key.begin(), key.end(), key.begin(), ::toupper);
+    // "auto" starts generic (or with the profile cached from the last boot) and
+    // switches once the IDN reply is in
+    this->auto_detect_ = key == "AUTO";
+    this->apply_profile_(this->auto_detect_ ? GENERIC_PROFILE : key);
+  }
+  const std::string &get_profile() const { return this->profile_; }
+  void set_command_rate(CommandPriority priority, float per_second) { this->scheduler_.set_rate(priority, per_second); }
+  void set_housekeeping_share(uint8_t every) { this->scheduler_.set_min_share(CommandPriority::HOUSEKEEPING, every); }
+  void set_interactive_latency_budget(uint32_t budget_ms) { this->interactive_latency_budget_ = budget_ms; }
+  const CommandScheduler &get_scheduler() const { return this->scheduler_; }
+  void set_write_coalesce(uint32_t window_ms) { this->write_coalesce_ = window_ms; }
+  // How often the reading memory is drained in buffered mode
+  void set_buffer_fetch_interval(uint32_t interval_ms) { this->buffer_fetch_interval_ = interval_ms; }
+  // Use single MEAS? queries even when the profile supports buffered acquisition
+  void set_buffered(bool buffered) { this->buffered_enabled_ = buffered; }
+  bool is_buffered() const { return this->buffered_enabled_ && !this->commands_.buffer_fetch.empty(); }
+
+  void set_state_poll_interval(uint32_t interval_ms) { this->state_poll_interval_ = interval_ms; }
+  const InstrumentState &get_state() const { return this->state_; }
+
+  // Requested state changes. Requests made within the coalesce window are merged and
+  // only fields that differ from the cached state are written to the meter.
+  void request_function(MeasurementFunction function) {
+    if (function == MeasurementFunction::UNKNOWN)
+      return;
+    this->begin_request_();
+    this->desired_.function = function;
+  }
+  void request_range(const std::string &range) {
+    this->begin_request_();
+    this->desired_.range = range;
+    this->desired_.auto_range = 0;
+  }
+  void request_auto_range(bool auto_range) {
+    this->begin_request_();
+    this->desired_.auto_range = auto_range;
+  }
+  void request_rate(const std::string &rate) {
+    this->begin_request_();
+    this->desired_.rate = rate;
+  }
+  void request_dual(bool dual) {
+    this->begin_request_();
+    this->desired_.dual = dual;
+  }
+
+  // Sequence configuration, used by codegen and the set_sequence service
+  void add_sequence_step(const std::string &function_command, const std::string &range_command, uint32_t settle_ms,
+                         uint8_t skip, uint8_t readings) {
+    this->sequence_.push_back(SequenceStep{function_command, range_command, settle_ms, skip,
+                                           std::max<uint8_t>(readings, 1)});
+  }
+  void set_sequence_autostart(bool autostart) { this->sequence_autostart_ = autostart; }
+
+  void add_on_sequence_callback(std::function<void(const std::vector<SequenceResult> &)> &&callback) {
+    this->sequence_callback_.add(std::move(callback));
+  }
+
+  void start_sequence() {
+    if (this->sequence_.empty()) {
+      ESP_LOGW("scpi_dmm", "Cannot start an empty sequence");
+      return;
+    }
+    this->sequence_index_ = 0;
+    this->sequence_cycle_ = 0;
+    this->sequence_results_.clear();
+    this->sequence_cycle_started_ = millis();
+    this->sequence_state_ = SequenceState::APPLY;
+    ESP_LOGI("scpi_dmm", "Sequence started with %u steps", (unsigned) this->sequence_.size());
+  }
+
+  void stop_sequence() {
+    if (this->sequence_state_ == SequenceState::IDLE)
+      return;
+    this->sequence_state_ = SequenceState::IDLE;
+    ESP_LOGI("scpi_dmm", "Sequence stopped after %u cycles", (unsigned) this->sequence_cycle_);
+  }
+
+  bool is_sequence_running() const { return this->sequence_state_ != SequenceState::IDLE; }
+
+  // Service handlers
+  void on_set_sequence(std::string sequence) {
+    std::vector<SequenceStep> steps;
+    if (!parse_sequence_(sequence, steps)) {
+      ESP_LOGW("scpi_dmm", "Invalid sequence: %s", sequence.c_str());
+      return;
+    }
+    bool was_running = this->is_sequence_running();
+    this->stop_sequence();
+    this->sequence_ = std::move(steps);
+    if (was_running)
+      this->start_sequence();
+  }
+  void on_start_sequence() { this->start_sequence(); }
+  void on_stop_sequence() { this->stop_sequence(); }
+
+  void on_set_function(std::string function) {
+    MeasurementFunction parsed = option_to_function_(function);
+    if (parsed == MeasurementFunction::UNKNOWN)
+      parsed = parse_function_(function);
+    if (parsed == MeasurementFunction::UNKNOWN) {
+      ESP_LOGW("scpi_dmm", "Unknown function: %s", function.c_str());
+      return;
+    }
+    this->request_function(parsed);
+  }
+  void on_set_range(std::string mode) { this->set_range_mode_(mode); }
+  void on_set_rate(std::string mode) { this->set_rate_(mode); }
+
+  // Asks the meter for *IDN? again; the reply updates the idn sensor and, with
+  // device_type auto, the profile
+  void identify() {
+    this->enqueue_(this->commands_.identify, ResponseKind::RAW, CommandPriority::INTERACTIVE,
+                   [this](bool ok, const std::string &response) { this->on_identify_(ok, response); });
+  }
+
+  void on_reset() {
+    this->stop_sequence();
+    // The meter goes back to its power-on defaults; re-learn them. Cleared before the
+    // switch so it does not carry the old function into the cache.
+    this->state_ = InstrumentState{};
+    this->state_dirty_ = false;
+    this->switch_to_({this->commands_.reset});
+    this->zero_offset_.fill(0.0f);
+    this->last_state_poll_ = millis() - this->state_poll_interval_;
+  }
+
+  // Report readings of the current function relative to the latest one. Applied after
+  // calibration on the node, so it costs no meter round-trip and survives range changes.
+  void on_relative_zero() {
+    MeasurementFunction function = this->state_.function;
+    if (this->last_corrected_function_ != function || std::isnan(this->last_corrected_)) {
+      ESP_LOGW("scpi_dmm", "No %s reading to zero against yet", function_to_string(function));
+      return;
+    }
+    this->zero_offset_[static_cast<size_t>(function)] = this->last_corrected_;
+    ESP_LOGI("scpi_dmm", "Relative zero for %s at %g", function_to_string(function), this->last_corrected_);
+  }
+  void on_clear_relative_zero() { this->zero_offset_[static_cast<size_t>(this->state_.function)] = 0.0f; }
+
+  // Send a user-issued SCPI command. It preempts background polling; queries ("...?")
+  // report their reply through the callback.
+  void send_command(const std::string &cmd, ResponseCallback callback = nullptr) {
+    std::string upper = cmd;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    bool query = !upper.empty() && upper.back() == '?';
+    if (!query && (upper.rfind("FUNC", 0) == 0 || upper.rfind("CONF", 0) == 0 || upper.rfind("SENS", 0) == 0)) {
+      // Function changes go through the switch transaction so no stale reading is published
+      this->switch_to_({cmd});
+      if (callback)
+        callback(true, "");
+      return;
     }
+    this->enqueue_(cmd, query ? ResponseKind::RAW : ResponseKind::NONE, CommandPriority::INTERACTIVE,
+                   std::move(callback));
+  }
+
+  void on_send_command(std::string command) {
+    this->send_command(command, [this, command](bool ok, const std::string &response) {
+      if (!ok) {
+        ESP_LOGW("scpi_dmm", "No response to %s", command.c_str());
+        return;
+      }
+      if (command.empty() || command.back() != '?')
+        return;
+      ESP_LOGD("scpi_dmm", "%s -> %s", command.c_str(), response.c_str());
+      this->fire_homeassistant_event("esphome.scpi_dmm_response", {{"source", to_string(this->source_)},
+                                                                   {"command", command},
+                                                                   {"response", response}});
+    });
+  }
+
+  // Fires esphome.scpi_dmm_history with the readings between start_ms and end_ms (uptime,
+  // negative = relative to now). With bucket_ms > 0 min/max/mean summaries are sent instead.
+  void on_query_history(int start_ms, int end_ms, int bucket_ms) {
+    if (this->history_ == nullptr)
+      return;
+    const uint32_t now = millis();
+    uint32_t from = resolve_history_time(start_ms, now);
+    uint32_t to = end_ms == 0 ? now : resolve_history_time(end_ms, now);
+    std::string json = "[";
+    char buf[64];
+    size_t count = 0;
+    if (bucket_ms > 0) {
+      this->history_->summarize(from, to, bucket_ms, [&](const HistorySummary &summary) {
+        if (count++ >= HISTORY_EVENT_MAX_POINTS)
+          return;
+        snprintf(buf, sizeof(buf), "%s[%u,\"%s\",%g,%g,%g]", json.size() > 1 ? "," : "",
+                 (unsigned) summary.start_ms, function_to_string(summary.function), summary.min, summary.max,
+                 summary.mean);
+        json += buf;
+      });
+    } else {
+      count = this->history_->query(from, to, HISTORY_EVENT_MAX_POINTS, [&](const Sample &sample) {
+        snprintf(buf, sizeof(buf), "%s[%u,%g,\"%s\"]", json.size() > 1 ? "," : "", (unsigned) sample.timestamp_ms,
+                 sample.value, function_to_string(sample.function));
+        json += buf;
+      });
+    }
+    json += "]";
+    this->fire_homeassistant_event("esphome.scpi_dmm_history",
+                                   {{"source", to_string(this->source_)}, {"now", to_string(now)}, {"points", json}});
+  }
+
+  // Set measurement function. Readings are suppressed until the meter has settled on it.
+  void set_function(const std::string &function) {
+    this->switch_to_({function});
+  }
+
+  // Switch transaction settings
+  void set_settle_tolerance(float tolerance) { this->settle_tolerance_ = tolerance; }
+  void set_settle_timeout(uint32_t timeout_ms) { this->settle_timeout_ = timeout_ms; }
+  void set_switch_discard(uint8_t count) { this->switch_discard_ = count; }
+  bool is_switching() const { return this->switch_state_ != SwitchState::IDLE; }
+  uint32_t get_learned_settle_ms(MeasurementFunction function) const {
+    return this->learned_settle_ms_[static_cast<size_t>(function)];
   }
 
   void query_measurement_() {
-    switch (current_function_) {
+    this->enqueue_(this->measure_command_(this->state_.function), ResponseKind::MEASUREMENT,
+                   CommandPriority::MEASUREMENT);
+  }
+
+  // The active profile's measurement query for function, plain MEAS? when it is unknown
+  const std::string &measure_command_(MeasurementFunction function) const {
+    static const std::string GENERIC_MEASURE{"MEAS?"};
+    switch (function) {
       case MeasurementFunction::VOLTAGE_DC:
-        send_command("MEAS:VOLT:DC?");
-        break;
+        return this->commands_.measure_voltage_dc;
       case MeasurementFunction::VOLTAGE_AC:
-        send_command("MEAS:VOLT:AC?");
-        break;
+        return this->commands_.measure_voltage_ac;
       case MeasurementFunction::CURRENT_DC:
-        send_command("MEAS:CURR:DC?");
-        break;
+        return this->commands_.measure_current_dc;
       case MeasurementFunction::CURRENT_AC:
-        send_command("MEAS:CURR:AC?");
-        break;
+        return this->commands_.measure_current_ac;
       case MeasurementFunction::RESISTANCE:
-        send_command("MEAS:RES?");
-        break;
+        return this->commands_.measure_resistance;
       case MeasurementFunction::FREQUENCY:
-        send_command("MEAS:FREQ?");
-        break;
+        return this->commands_.measure_frequency;
       case MeasurementFunction::CAPACITANCE:
-        send_command("MEAS:CAP?");
-        break;
+        return this->commands_.measure_capacitance;
       case MeasurementFunction::TEMPERATURE:
-        send_command("MEAS:TEMP?");
-        break;
+        return this->commands_.measure_temperature;
       case MeasurementFunction::CONTINUITY:
-        send_command("MEAS:CONT?");
-        break;
+        return this->commands_.measure_continuity;
       case MeasurementFunction::DIODE:
-        send_command("MEAS:DIOD?");
-        break;
+        return this->commands_.measure_diode;
       default:
-        send_command("MEAS?");
-        break;
+        return GENERIC_MEASURE;
     }
   }
 
@@ -232,28 +756,91 @@ class SCPIDMM : public Component, public uart::UARTDevice, public api::CustomAPI
     if (response.empty())
       return;
 
-    // Handle IDN response
-    if (waiting_for_idn_) {
-      if (this->idn_sensor != nullptr) {
-        this->idn_sensor->publish_state(response);
-      }
-      waiting_for_idn_ = false;
+    if (this->query_.kind() == ResponseKind::RAW) {
+      ResponseCallback callback = this->finish_query_(true);
+      if (callback)
+        callback(true, response);
+      return;
+    }
+
+    if (this->query_.kind() != ResponseKind::NONE && this->query_.kind() != ResponseKind::MEASUREMENT) {
+      ResponseKind kind = this->query_.kind();
+      ResponseCallback callback = this->finish_query_(true);
+      this->handle_state_response_(kind, response);
+      if (callback)
+        callback(true, response);
       return;
     }
 
     // Try to parse as a numeric value
     try {
       float value = parse_numeric_response_(response);
+      if (!this->query_pending_()) {
+        // Late answer to a timed-out or pre-switch query
+        ESP_LOGV("scpi_dmm", "Discarding unsolicited reading: %s", response.c_str());
+        this->metrics_.on_unsolicited();
+        return;
+      }
+      this->finish_query_(true);
+      if (this->switch_state_ != SwitchState::IDLE && !this->on_switch_reading_(value))
+        return;
+      value = this->correct_(value);
+      Sample sample{millis(), value, this->state_.function, this->source_};
+      sample.actual_ms = this->query_.sent_at();
+      if (this->timed_sample_)
+        sample.timestamp_ms = this->due_ms_;
+      this->pipeline_->push(sample);
+      if (this->sequence_state_ != SequenceState::IDLE) {
+        this->on_sequence_reading_(value);
+        return;
+      }
       if (this->value_sensor != nullptr) {
         this->value_sensor->publish_state(value);
       }
     } catch (...) {
       // Non-numeric response - could be status or error
       ESP_LOGW("scpi_dmm", "Non-numeric response: %s", response.c_str());
+      if (this->query_.kind() != ResponseKind::MEASUREMENT)
+        return;
+      // The meter did answer; end the query now instead of at its timeout
+      this->finish_query_(true);
+      this->metrics_.on_invalid();
+      if (this->switch_state_ != SwitchState::IDLE) {
+        this->on_switch_invalid_();
+      } else if (this->sequence_state_ != SequenceState::IDLE) {
+        this->on_sequence_invalid_();
+      }
     }
   }
 
+  // Maps a function_select option to its function
+  static MeasurementFunction option_to_function_(const std::string &option) {
+    static const MeasurementFunction FUNCTIONS[] = {
+        MeasurementFunction::VOLTAGE_DC, MeasurementFunction::VOLTAGE_AC, MeasurementFunction::CURRENT_DC,
+        MeasurementFunction::CURRENT_AC, MeasurementFunction::RESISTANCE, MeasurementFunction::CAPACITANCE,
+        MeasurementFunction::CONTINUITY, MeasurementFunction::DIODE};
+    for (size_t i = 0; i < sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]); i++) {
+      if (FUNCTION_OPTIONS[i] == option)
+        return FUNCTIONS[i];
+    }
+    return MeasurementFunction::UNKNOWN;
+  }
+
+  static const std::string *function_to_option_(MeasurementFunction function) {
+    for (const auto &option : FUNCTION_OPTIONS) {
+      if (option_to_function_(option) == function)
+        return &option;
+    }
+    return nullptr;
+  }
+
   float parse_numeric_response_(const std::string &response) {
+    ReadingFormat format = this->commands_.reading_format;
+    if (this->rx_framer_.is_block() && format != ReadingFormat::ASCII) {
+      if (response.size() < reading_format_size(format))
+        throw std::invalid_argument("short binary reading");
+      return decode_real(reinterpret_cast<const uint8_t *>(response.data()), format, false);
+    }
     return std::stof(response);
   }
 
@@ -275,10 +862,1202 @@ class SCPIDMM : public Component, public uart::UARTDevice, public api::CustomAPI
     return MeasurementFunction::UNKNOWN;
   }
 
+  // Parses "FUNC1 VOLT:DC,settle=200,skip=1,n=3;FUNC1 RES,range=RANGE 5K,n=2" into steps
+  static bool parse_sequence_(const std::string &text, std::vector<SequenceStep> &steps) {
+    size_t start = 0;
+    while (start <= text.size()) {
+      size_t end = text.find(';', start);
+      if (end == std::string::npos)
+        end = text.size();
+      std::string step_text = text.substr(start, end - start);
+      start = end + 1;
+      if (step_text.find_first_not_of(' ') == std::string::npos)
+        continue;
+
+      SequenceStep step;
+      size_t field_start = 0;
+      bool first = true;
+      while (field_start <= step_text.size()) {
+        size_t field_end = step_text.find(',', field_start);
+        if (field_end == std::string::npos)
+          field_end = step_text.size();
+        std::string field = step_text.substr(field_start, field_end - field_start);
+        field_start = field_end + 1;
+        field.erase(0, field.find_first_not_of(' '));
+        field.erase(field.find_last_not_of(' ') + 1);
+        if (first) {
+          step.function_command = field;
+          first = false;
+          continue;
+        }
+        size_t eq = field.find('=');
+        if (eq == std::string::npos)
+          return false;
+        std::string key = field.substr(0, eq);
+        std::string value = field.substr(eq + 1);
+        char *parse_end = nullptr;
+        unsigned long number = strtoul(value.c_str(), &parse_end, 10);
+        bool numeric = !value.empty() && *parse_end == '\0';
+        if (key == "range") {
+          step.range_command = value;
+        } else if (key == "settle" && numeric) {
+          step.settle_ms = number;
+        } else if (key == "skip" && numeric && number <= 255) {
+          step.skip = number;
+        } else if (key == "n" && numeric && number >= 1 && number <= 255) {
+          step.readings = number;
+        } else {
+          return false;
+        }
+      }
+      if (step.function_command.empty() && step.range_command.empty())
+        return false;
+      steps.push_back(step);
+    }
+    return !steps.empty();
+  }
+
  protected:
-  std::string rx_buffer_;
-  MeasurementFunction current_function_{MeasurementFunction::UNKNOWN};
-  bool waiting_for_idn_{true};
+  bool query_pending_() const { return this->query_.pending(); }
+
+  // The first meter keeps the plain service names and URLs, others get a "dmm<N>" prefix
+  std::string service_name_(const char *name) const {
+    return this->source_ == 0 ? std::string(name) : "dmm" + to_string(this->source_) + "_" + name;
+  }
+  std::string route_prefix_() const { return this->source_ == 0 ? "" : "/dmm" + to_string(this->source_); }
+#ifdef USE_MQTT
+  // Default MQTT topics live below <topic_prefix>/dmm, or dmm<N> for the other meters
+  std::string mqtt_topic_base_() const {
+    std::string node = this->source_ == 0 ? "dmm" : "dmm" + to_string(this->source_);
+    return mqtt::global_mqtt_client->get_topic_prefix() + "/" + node;
+  }
+#endif
+
+  void setup_rx_() {
+    if (this->rx_ != nullptr)
+      return;
+#ifdef USE_ESP_IDF
+    if (this->rx_events_) {
+      auto *uart = static_cast<uart::IDFUARTComponent *>(this->parent_);
+      this->own_rx_ = std::unique_ptr<RxSource>(new ESP32EventRxSource(this, uart));
+      if (!this->own_rx_->start()) {
+        ESP_LOGW("scpi_dmm", "UART events unavailable, polling for received data");
+        this->own_rx_ = nullptr;
+      }
+    }
+#endif
+    if (this->own_rx_ == nullptr)
+      this->own_rx_ = std::unique_ptr<RxSource>(new PolledRxSource(this));
+    this->rx_ = this->own_rx_.get();
+  }
+
+  void discard_rx_() {
+    uint8_t buffer[RX_CHUNK_SIZE];
+    while (this->rx_->read(buffer, sizeof(buffer)) > 0) {
+    }
+  }
+
+  void receive_byte_(uint8_t c) {
+    // Binary payloads may contain anything, the power-up bytes included
+    bool binary = this->rx_framer_.is_block() ||
+                  (this->query_.kind() == ResponseKind::READING_LIST && this->commands_.reading_format != ReadingFormat::ASCII);
+    if (!binary && this->soft_start_.feed(c)) {
+      this->on_soft_start_();
+      return;
+    }
+    if (this->query_.kind() == ResponseKind::READING_LIST) {
+      this->feed_reading_list_(c);
+      return;
+    }
+    if (this->rx_framer_.feed(c)) {
+      if (this->rx_framer_.is_truncated())
+        ESP_LOGW("scpi_dmm", "Reply longer than %u bytes, truncated", (unsigned) MAX_RESPONSE_LENGTH);
+      this->handle_response_(this->rx_framer_.get());
+      this->rx_framer_.clear();
+    }
+  }
+
+  // Calibration, then the relative zero, for one valid reading of the current function
+  float correct_(float value) {
+    if (this->active_calibration_ != nullptr)
+      value = this->active_calibration_->apply(value);
+    this->last_corrected_ = value;
+    this->last_corrected_function_ = this->state_.function;
+    return value - this->zero_offset_[static_cast<size_t>(this->state_.function)];
+  }
+
+  // Subscribes a per-meter consumer to this meter's samples only
+  void add_sink_(std::function<void(const Sample &)> &&sink) {
+    const uint8_t source = this->source_;
+    this->pipeline_->add_sink([source, sink](const Sample &sample) {
+      if (sample.source == source)
+        sink(sample);
+    });
+  }
+
+  // Fails the query in flight, e.g. after a timeout
+  void abandon_query_() {
+    if (!this->query_pending_())
+      return;
+    ResponseCallback callback = this->finish_query_(false);
+    if (callback)
+      callback(false, "");
+  }
+
+  // Ends the query in flight, reporting it to on_query_complete_; returns its callback
+  ResponseCallback finish_query_(bool answered) { return this->query_.finish(answered, millis()); }
+
+  // The meter power-cycled: it dropped whatever it was doing and is back at its defaults
+  void on_soft_start_() {
+    ESP_LOGW("scpi_dmm", "Meter power-cycled, re-initialising");
+    this->soft_starts_++;
+    InstrumentState restore = this->state_dirty_ ? this->desired_ : this->state_;
+    if (restore.rate.empty() && !this->commands_.fast_mode.empty() && !this->commands_.select_rate.empty())
+      restore.rate = this->commands_.fast_mode.substr(this->commands_.select_rate.size());
+
+    this->rx_framer_.clear();
+    // The reset swallowed the query in flight; that is no timeout, so it is not reported
+    this->query_.drop();
+    // A meter that just powered up is alive, whatever the watchdog thought
+    if (this->watchdog_.on_query(true, millis()))
+      this->on_link_state_();
+    this->scheduler_.clear(CommandPriority::MEASUREMENT);
+    this->scheduler_.clear(CommandPriority::HOUSEKEEPING);
+    this->due_pending_ = false;
+    this->buffer_armed_ = false;
+    this->enqueue_(this->commands_.remote_enable, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+    for (const auto &command : this->commands_.reinit_commands)
+      this->enqueue_(command, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+
+    // Everything the meter had is gone; write back the whole cached state right away
+    this->state_ = InstrumentState{};
+    this->desired_ = restore;
+    this->state_dirty_ = true;
+    this->state_dirty_at_ = millis() - this->write_coalesce_;
+    this->last_state_poll_ = millis();
+  }
+
+  void apply_profile_(const std::string &key) {
+    auto it = DEVICE_COMMANDS.find(key);
+    this->commands_ = it != DEVICE_COMMANDS.end() ? it->second : DeviceCommands{};
+    this->profile_ = key;
+  }
+
+  void load_profile_() {
+    this->profile_pref_ = global_preferences->make_preference<DetectedProfile>(
+        fnv1_hash("scpi_dmm_profile_" + to_string(this->source_)), true);
+    DetectedProfile stored{};
+    if (!this->profile_pref_.load(&stored))
+      return;
+    stored.profile[sizeof(stored.profile) - 1] = '\0';
+    this->idn_hash_ = stored.idn_hash;
+    this->apply_profile_(stored.profile);
+    ESP_LOGCONFIG("scpi_dmm", "Starting with cached profile %s, verifying against *IDN?", this->profile_.c_str());
+  }
+
+  void on_identify_(bool ok, const std::string &idn) {
+    if (ok && this->baud_autodetect_ && !idn_plausible(idn))
+      ok = false;  // line noise, most likely the wrong rate
+    if (!ok) {
+      if (this->detect_next_baud_())
+        return;
+      // Held boot commands keep waiting for a rate the meter answers at
+      if (this->warm_pending_ && !this->init_pending_)
+        this->cold_start_("no *IDN? reply");
+      return;
+    }
+    if (this->idn_sensor != nullptr)
+      this->idn_sensor->publish_state(idn);
+    uint32_t hash = fnv1_hash(idn);
+    // hash == idn_hash_: the meter the cached profile was detected on
+    if (this->auto_detect_ && hash != this->idn_hash_)
+      this->detect_profile_(idn, hash);
+    this->meter_idn_hash_ = hash;
+    bool warm = this->warm_pending_;
+    if (this->warm_pending_) {
+      this->warm_pending_ = false;
+      if (hash != this->saved_warm_.idn_hash || fnv1_hash(this->profile_) != this->saved_warm_.profile_hash) {
+        this->cold_start_("a different meter answered");
+      } else {
+        ESP_LOGI("scpi_dmm", "Same meter as before the reboot, checking its state");
+      }
+    }
+    if (this->init_pending_)
+      this->send_init_commands_(warm);
+    this->detect_left_ = 0;
+    this->start_baud_negotiation_();
+  }
+
+  const std::string &baud_command_() const {
+    return this->baud_command_override_.empty() ? this->commands_.select_baud : this->baud_command_override_;
+  }
+
+  void set_baud_(uint32_t rate) {
+    apply_uart_baud_rate(this->parent_, rate);
+    this->rx_framer_.clear();
+    this->soft_start_.reset();
+  }
+
+  // Auto-detection: moves on to the next rate; true when another *IDN? went out for it
+  bool detect_next_baud_() {
+    if (!this->baud_autodetect_ || this->baud_state_ != BaudState::IDLE || this->baud_rates_.size() < 2)
+      return false;
+    uint32_t rate = this->baud_rates_.next_after(this->parent_->get_baud_rate());
+    ESP_LOGD("scpi_dmm", "No valid *IDN? reply, trying %u baud", (unsigned) rate);
+    this->set_baud_(rate);
+    if (this->detect_left_ == 0)
+      return false;  // the remaining rates are left to the watchdog's probes
+    this->detect_left_--;
+    this->enqueue_(this->commands_.identify, ResponseKind::RAW, CommandPriority::CONFIGURATION,
+                   [this](bool ok, const std::string &response) { this->on_identify_(ok, response); });
+    return true;
+  }
+
+  void start_baud_negotiation_() {
+    if (!this->baud_negotiate_ || this->baud_state_ != BaudState::IDLE || this->baud_command_().empty())
+      return;
+    uint32_t current = this->parent_->get_baud_rate();
+    uint32_t target = this->baud_rates_.faster_than(current);
+    if (target == 0)
+      return;
+    ESP_LOGI("scpi_dmm", "Trying %u baud (now %u)", (unsigned) target, (unsigned) current);
+    this->baud_from_ = current;
+    this->change_baud_(target);
+  }
+
+  // Tells the meter to switch and follows once the command has gone out
+  void change_baud_(uint32_t rate) {
+    this->baud_target_ = rate;
+    this->baud_state_ = BaudState::CHANGE;
+    this->scheduler_.clear(CommandPriority::MEASUREMENT);
+    this->scheduler_.clear(CommandPriority::HOUSEKEEPING);
+    this->due_pending_ = false;
+    this->enqueue_(this->baud_command_() + to_string(rate), ResponseKind::NONE, CommandPriority::CONFIGURATION,
+                   [this](bool ok, const std::string &response) {
+                     if (!ok) {
+                       // Never sent; the meter is still at the old rate
+                       this->baud_state_ = BaudState::IDLE;
+                       this->baud_reverting_ = false;
+                       return;
+                     }
+                     this->set_baud_(this->baud_target_);
+                     this->baud_state_ = BaudState::SETTLE;
+                     this->baud_changed_at_ = millis();
+                   });
+  }
+
+  void run_baud_() {
+    if (this->baud_state_ != BaudState::SETTLE || millis() - this->baud_changed_at_ < BAUD_SETTLE_MS)
+      return;
+    this->baud_state_ = BaudState::VERIFY;
+    this->verify_left_ = this->baud_reverting_ ? 1 : this->baud_verify_count_;
+    this->send_baud_probe_();
+  }
+
+  void send_baud_probe_() {
+    this->enqueue_(this->commands_.identify, ResponseKind::RAW, CommandPriority::CONFIGURATION,
+                   [this](bool ok, const std::string &response) { this->on_baud_probe_(ok, response); });
+  }
+
+  void on_baud_probe_(bool ok, const std::string &reply) {
+    if (ok && fnv1_hash(reply) == this->meter_idn_hash_) {
+      if (--this->verify_left_ > 0) {
+        this->send_baud_probe_();
+        return;
+      }
+      this->baud_state_ = BaudState::IDLE;
+      ESP_LOGI("scpi_dmm", "Link running at %u baud", (unsigned) this->baud_target_);
+      if (this->baud_reverting_) {
+        // Try the next slower rate that is still faster than this one
+        this->baud_reverting_ = false;
+        this->start_baud_negotiation_();
+      }
+      return;
+    }
+    if (this->baud_reverting_) {
+      // Neither rate answers; find the meter again
+      ESP_LOGW("scpi_dmm", "No reply at %u baud either, searching", (unsigned) this->baud_target_);
+      this->baud_reverting_ = false;
+      this->baud_state_ = BaudState::IDLE;
+      this->detect_left_ = this->baud_rates_.size() - 1;
+      this->detect_next_baud_();
+      return;
+    }
+    ESP_LOGW("scpi_dmm", "%u baud failed verification, falling back to %u", (unsigned) this->baud_target_,
+             (unsigned) this->baud_from_);
+    this->baud_rates_.mark_failed(this->baud_target_);
+    this->baud_reverting_ = true;
+    // The meter most likely did switch, so the way back is asked for at the new rate
+    this->change_baud_(this->baud_from_);
+  }
+
+  void detect_profile_(const std::string &idn, uint32_t hash) {
+    std::string profile = detect_profile(idn);
+    ESP_LOGI("scpi_dmm", "Detected profile %s from \"%s\"", profile.c_str(), idn.c_str());
+    this->idn_hash_ = hash;
+    if (profile != this->profile_) {
+      this->apply_profile_(profile);
+      this->soft_start_.set_pattern(this->commands_.soft_start_pattern);
+      // Whatever was learned with the old command set does not apply
+      this->buffer_armed_ = false;
+      this->enqueue_(this->commands_.remote_enable, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+      this->state_ = InstrumentState{};
+      this->last_state_poll_ = millis() - this->state_poll_interval_;
+    }
+    DetectedProfile stored{hash, {}};
+    strncpy(stored.profile, profile.c_str(), sizeof(stored.profile) - 1);
+    if (!this->profile_pref_.save(&stored))
+      ESP_LOGW("scpi_dmm", "Could not persist the detected profile");
+  }
+
+  // Adopts the state saved before the reboot as the cache. It is used right away and
+  // confirmed by *IDN? and the first state poll; returns false when there is none.
+  bool load_warm_state_() {
+    // RTC memory where the platform has it, otherwise flash with the usual write batching
+    this->warm_pref_ = global_preferences->make_preference<WarmState>(
+        fnv1_hash("scpi_dmm_warm_" + to_string(this->source_)));
+    WarmState warm;
+    // Without a function query the loaded state could never be confirmed
+    if (this->commands_.query_function.empty() || !this->warm_pref_.load(&warm) || warm.version != WARM_STATE_VERSION ||
+        warm.profile_hash != fnv1_hash(this->profile_) ||
+        warm.function >= static_cast<uint8_t>(MeasurementFunction::UNKNOWN))
+      return false;
+    this->saved_warm_ = warm;
+    if (warm.baud_rate != 0 && warm.baud_rate != this->parent_->get_baud_rate()) {
+      ESP_LOGCONFIG("scpi_dmm", "Resuming at %u baud", (unsigned) warm.baud_rate);
+      this->set_baud_(warm.baud_rate);
+    }
+    this->state_.function = static_cast<MeasurementFunction>(warm.function);
+    this->state_.range = warm_state_read(warm.range);
+    this->state_.rate = warm_state_read(warm.rate);
+    this->state_.auto_range = warm.auto_range;
+    this->state_.dual = warm.dual;
+    std::copy(std::begin(warm.learned_settle_ms), std::end(warm.learned_settle_ms), this->learned_settle_ms_.begin());
+    this->warm_pending_ = true;
+    ESP_LOGCONFIG("scpi_dmm", "Warm start, skipping *RST unless another meter answers");
+    return true;
+  }
+
+  // The meter may have been power-cycled with the node and come up at its own defaults,
+  // so the loaded state is read back before anything is measured with it. The queries
+  // go out as configuration traffic, ahead of any measurement, and measuring waits
+  // for the function reply.
+  // Reset to known state, unless the state from before a reboot can be reused, then
+  // set remote mode if supported
+  void send_init_commands_(bool warm) {
+    this->init_pending_ = false;
+    if (warm) {
+      this->verify_warm_state_();
+    } else {
+      this->enqueue_(this->commands_.reset, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+    }
+    this->enqueue_(this->commands_.remote_enable, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+  }
+
+  void verify_warm_state_() {
+    this->state_unverified_ = true;
+    this->state_.function = MeasurementFunction::UNKNOWN;  // whatever the meter reports
+    this->enqueue_(this->commands_.query_function, ResponseKind::FUNCTION, CommandPriority::CONFIGURATION,
+                   [this](bool ok, const std::string &response) {
+                     if (!this->state_unverified_)
+                       return;
+                     if (!ok || this->state_.function == MeasurementFunction::UNKNOWN) {
+                       this->cold_start_("no function reply");
+                       return;
+                     }
+                     this->state_unverified_ = false;
+                     ESP_LOGI("scpi_dmm", "Meter confirmed %s", function_to_string(this->state_.function));
+                   });
+    this->enqueue_(this->commands_.query_auto_range, ResponseKind::AUTO_RANGE, CommandPriority::CONFIGURATION);
+    this->enqueue_(this->commands_.query_rate, ResponseKind::RATE, CommandPriority::CONFIGURATION);
+    this->enqueue_(this->commands_.query_range, ResponseKind::RANGE, CommandPriority::CONFIGURATION);
+  }
+
+  // The saved state does not belong to this meter: reset it like a normal boot
+  void cold_start_(const char *reason) {
+    ESP_LOGW("scpi_dmm", "Discarding the saved state (%s), resetting the meter", reason);
+    this->warm_pending_ = false;
+    this->state_unverified_ = false;
+    this->init_pending_ = false;
+    this->enqueue_(this->commands_.reset, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+    this->enqueue_(this->commands_.remote_enable, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+    this->state_ = InstrumentState{};
+    this->learned_settle_ms_.fill(0);
+    this->buffer_armed_ = false;
+    this->last_state_poll_ = millis() - this->state_poll_interval_;
+  }
+
+  // Writes the cache when it changed; the preference layer batches flash writes
+  void save_warm_state_() {
+    if (this->warm_pending_ || this->baud_state_ != BaudState::IDLE || this->meter_idn_hash_ == 0 ||
+        this->state_.function == MeasurementFunction::UNKNOWN)
+      return;
+    WarmState warm;
+    memset(&warm, 0, sizeof(warm));
+    warm.version = WARM_STATE_VERSION;
+    warm.idn_hash = this->meter_idn_hash_;
+    warm.profile_hash = fnv1_hash(this->profile_);
+    if (this->baud_rates_.size() > 0)
+      warm.baud_rate = this->parent_->get_baud_rate();
+    warm.function = static_cast<uint8_t>(this->state_.function);
+    warm.auto_range = this->state_.auto_range;
+    warm.dual = this->state_.dual;
+    warm_state_copy(warm.range, this->state_.range);
+    warm_state_copy(warm.rate, this->state_.rate);
+    std::copy(this->learned_settle_ms_.begin(), this->learned_settle_ms_.end(), warm.learned_settle_ms);
+    if (memcmp(&warm, &this->saved_warm_, sizeof(warm)) == 0)
+      return;
+    if (this->warm_pref_.save(&warm))
+      this->saved_warm_ = warm;
+  }
+
+  // Every query ends here once, answered or timed out
+  void on_query_complete_(bool answered, uint32_t elapsed_ms) {
+    this->metrics_.on_query(answered, elapsed_ms);
+    if (this->watchdog_.on_query(answered, millis()))
+      this->on_link_state_();
+  }
+
+  // A measurement query is queued or awaiting its reply
+  bool measurement_outstanding_() const {
+    return this->query_.kind() == ResponseKind::MEASUREMENT || this->scheduler_.has_pending(CommandPriority::MEASUREMENT);
+  }
+
+  void enqueue_(const std::string &command, ResponseKind kind, CommandPriority priority,
+                ResponseCallback callback = nullptr) {
+    if (command.empty())
+      return;
+    ScheduledCommand scheduled;
+    scheduled.text = command;
+    scheduled.kind = kind;
+    scheduled.priority = priority;
+    scheduled.callback = std::move(callback);
+    this->scheduler_.enqueue(std::move(scheduled), millis());
+  }
+
+  void transmit_(const std::string &command) { this->write_str((command + "\r\n").c_str()); }
+
+  // Feeds the link while it is free. Writes do not hold the link, so several can go out at once.
+  void dispatch_() {
+    ScheduledCommand command;
+    while (!this->query_pending_() && this->scheduler_.next(millis(), command)) {
+      if (command.priority == CommandPriority::INTERACTIVE) {
+        uint32_t wait = millis() - command.enqueued_at;
+        if (wait > this->interactive_latency_budget_)
+          ESP_LOGW("scpi_dmm", "Interactive command waited %u ms", (unsigned) wait);
+      }
+      this->transmit_(command.text);
+      if (command.kind == ResponseKind::NONE) {
+        if (command.callback)
+          command.callback(true, "");
+        continue;
+      }
+      this->query_.start(command.kind, std::move(command.callback), millis());
+      this->timed_sample_ = command.kind == ResponseKind::MEASUREMENT && this->due_pending_;
+      if (this->timed_sample_) {
+        // Both times on the millis() timebase of the pipeline
+        const uint32_t now_us = micros();
+        if (this->sample_clock_.is_running())
+          this->sample_clock_.record(this->due_us_, now_us);
+        this->due_ms_ = this->query_.sent_at() - (now_us - this->due_us_) / 1000;
+        this->due_pending_ = false;
+      }
+      if (this->trigger_output_ != nullptr &&
+          (command.kind == ResponseKind::MEASUREMENT || command.text == this->commands_.buffer_start))
+        this->trigger_output_->pulse();
+      if (command.kind == ResponseKind::MEASUREMENT || command.kind == ResponseKind::READING_LIST) {
+        // Resolved once per query; a function or range change goes through a switch first
+        this->active_calibration_ = this->calibration_.select(this->state_.function, this->state_.range);
+      }
+      if (command.kind == ResponseKind::READING_LIST) {
+        this->reading_parser_.reset();
+        this->reading_parser_.set_format(this->commands_.reading_format);
+      }
+    }
+  }
+
+  void on_link_state_() {
+    LinkState state = this->watchdog_.get_state();
+    if (state == LinkState::OFFLINE) {
+      ESP_LOGW("scpi_dmm", "Meter not answering, next probe in %u ms", (unsigned) this->watchdog_.get_backoff_ms());
+    } else {
+      ESP_LOGI("scpi_dmm", "Link %s", link_state_to_string(state));
+    }
+    if (this->status_sensor != nullptr)
+      this->status_sensor->publish_state(link_state_to_string(state));
+#ifdef USE_MQTT
+    if (this->mqtt_bridge_ != nullptr)
+      this->mqtt_bridge_->set_link_state(state);
+#endif
+    if (state == LinkState::OFFLINE) {
+      // Nothing queued for a dead link is worth sending later
+      this->scheduler_.clear(CommandPriority::MEASUREMENT);
+      this->scheduler_.clear(CommandPriority::HOUSEKEEPING);
+      this->due_pending_ = false;
+      // The meter may come back at another rate, e.g. its default after a power cycle
+      if (this->baud_autodetect_ && this->baud_rates_.size() > 0)
+        this->detect_left_ = this->baud_rates_.size() - 1;
+    } else if (state == LinkState::ONLINE) {
+      // Back from an outage: re-arm and check the cache right away
+      this->buffer_armed_ = false;
+      this->last_state_poll_ = millis() - this->state_poll_interval_;
+    }
+  }
+
+  // Background work that generates link traffic, in order of precedence
+  void produce_commands_() {
+    if (this->baud_state_ != BaudState::IDLE) {
+      this->run_baud_();
+      return;
+    }
+    if (this->watchdog_.is_suspended()) {
+      // Only a cheap probe until the meter answers again
+      if (!this->query_pending_() && this->watchdog_.probe_due(millis())) {
+        // The meter may have been swapped while the link was down
+        this->enqueue_(this->commands_.identify, ResponseKind::RAW, CommandPriority::HOUSEKEEPING,
+                       [this](bool ok, const std::string &response) { this->on_identify_(ok, response); });
+        this->watchdog_.on_probe_sent();
+        this->on_link_state_();
+      }
+      return;
+    }
+    if (this->switch_state_ != SwitchState::IDLE) {
+      this->run_switch_();
+      return;
+    }
+
+    // Send the coalesced state change once the window has passed
+    if (this->state_dirty_ && millis() - this->state_dirty_at_ >= this->write_coalesce_) {
+      this->flush_state_();
+      return;
+    }
+
+    // Interleave cheap state queries with measurements to keep the cache honest
+    if (millis() - this->last_state_poll_ >= this->state_poll_interval_ &&
+        !this->scheduler_.has_pending(CommandPriority::HOUSEKEEPING))
+      this->poll_state_();
+
+    // Interactive commands only ever wait for the reply already in flight
+    if (this->scheduler_.has_pending(CommandPriority::INTERACTIVE))
+      return;
+
+    // No reading may be tagged with a function the meter has not confirmed, nor taken
+    // before the boot commands went out
+    if (this->state_unverified_ || this->init_pending_)
+      return;
+
+    if (this->sequence_state_ != SequenceState::IDLE) {
+      // Sequences take single readings, which ends continuous triggering
+      this->buffer_armed_ = false;
+      this->run_sequence_();
+      return;
+    }
+
+    if (this->is_buffered()) {
+      this->run_buffered_();
+      return;
+    }
+
+    if (this->trigger_input_ != nullptr) {
+      // One reading per edge, stamped with the edge time; no free-running polls
+      if (!this->measurement_outstanding_() && this->trigger_input_->take(this->due_us_)) {
+        this->due_pending_ = true;
+        query_measurement_();
+      }
+      return;
+    }
+
+    if (this->sample_clock_enabled_) {
+      // Ticks passing while a query is outstanding are counted as missed
+      if (!this->measurement_outstanding_() && this->sample_clock_.take_tick(this->due_us_)) {
+        this->due_pending_ = true;
+        query_measurement_();
+      }
+      return;
+    }
+
+    // Periodically query measurements
+    if (!this->measurement_outstanding_() && millis() - last_query_ >= query_interval_) {
+      query_measurement_();
+      last_query_ = millis();
+    }
+  }
+
+  // Buffered acquisition: arm once, then drain the reading memory every fetch interval
+  void run_buffered_() {
+    if (this->trigger_input_ != nullptr) {
+      // Each edge starts a new batch, timed from the edge; nothing is armed before the first
+      uint32_t edge_us;
+      if (this->trigger_input_->take(edge_us)) {
+        this->enqueue_(this->commands_.buffer_start, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+        this->buffer_armed_ = true;
+        this->buffer_window_start_ = millis() - (micros() - edge_us) / 1000;
+        return;
+      }
+      if (!this->buffer_armed_)
+        return;
+    } else if (!this->buffer_armed_) {
+      this->enqueue_(this->commands_.buffer_start, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+      this->buffer_armed_ = true;
+      this->buffer_window_start_ = millis();
+      return;
+    }
+    if (!this->measurement_outstanding_() && millis() - this->last_query_ >= this->buffer_fetch_interval_) {
+      this->enqueue_(this->commands_.buffer_fetch, ResponseKind::READING_LIST, CommandPriority::MEASUREMENT);
+      this->last_query_ = millis();
+    }
+  }
+
+  void feed_reading_list_(uint8_t c) {
+    auto result = this->reading_parser_.feed(c, [this](float value) { this->on_buffered_reading_(value); });
+    if (result == ReadingListParser::Result::MORE)
+      return;
+    if (result == ReadingListParser::Result::ERROR) {
+      ESP_LOGW("scpi_dmm", "Malformed reading list after %u values", (unsigned) this->reading_parser_.get_count());
+      this->finish_query_(false);
+      return;
+    }
+    this->finish_query_(true);
+
+    // The readings were taken since the previous fetch; spread the next batch the same way
+    const uint32_t now = millis();
+    uint32_t count = this->reading_parser_.get_count();
+    if (count > 0) {
+      this->buffer_reading_interval_ = (now - this->buffer_window_start_) / count;
+      this->buffer_window_start_ = now;
+      ESP_LOGV("scpi_dmm", "Drained %u buffered readings", (unsigned) count);
+      if (this->value_sensor != nullptr)
+        this->value_sensor->publish_state(this->buffer_last_value_);
+    }
+  }
+
+  // Called for each value as soon as it is parsed, before the rest of the batch arrives
+  void on_buffered_reading_(float value) {
+    // 9.9E37 is the SCPI overload marker
+    if (!std::isfinite(value) || std::fabs(value) >= 9.9e37f)
+      return;
+    uint32_t index = this->reading_parser_.get_count();
+    uint32_t timestamp = this->buffer_window_start_ + index * this->buffer_reading_interval_;
+    timestamp = std::min(timestamp, millis());
+    value = this->correct_(value);
+    this->pipeline_->push(Sample{timestamp, value, this->state_.function, this->source_, timestamp});
+    this->buffer_last_value_ = value;
+  }
+
+  // Select callbacks; these fire on restores and re-selections too, the cache filters them
+  void set_function_(const std::string &option) { this->request_function(option_to_function_(option)); }
+
+  void set_range_mode_(const std::string &mode) {
+    if (mode == RANGE_OPTIONS[0]) {
+      this->request_auto_range(true);
+    } else if (mode == RANGE_OPTIONS[1]) {
+      this->request_auto_range(false);
+    } else {
+      this->request_range(mode);
+    }
+  }
+
+  void set_rate_(const std::string &mode) {
+    if (mode == RATE_OPTIONS[1]) {
+      this->request_rate("F");
+    } else if (mode == RATE_OPTIONS[0]) {
+      this->request_rate("M");
+    } else {
+      this->request_rate(mode);
+    }
+  }
+
+  void begin_request_() {
+    if (this->state_dirty_)
+      return;
+    // The coalesce window starts with the first change so a stream of changes cannot starve the write
+    this->desired_ = this->state_;
+    this->state_dirty_ = true;
+    this->state_dirty_at_ = millis();
+  }
+
+  void flush_state_() {
+    this->state_dirty_ = false;
+    const DeviceCommands &cmds = this->commands_;
+    std::vector<std::string> commands;
+    if (this->desired_.function != this->state_.function && !cmds.select_function.empty())
+      commands.push_back(cmds.select_function + function_to_string(this->desired_.function));
+    if (this->desired_.auto_range >= 0 && this->desired_.auto_range != this->state_.auto_range) {
+      const std::string &command = this->desired_.auto_range ? cmds.auto_range_on : cmds.auto_range_off;
+      if (!command.empty())
+        commands.push_back(command);
+    }
+    if (!this->desired_.range.empty() && this->desired_.range != this->state_.range && !cmds.select_range.empty())
+      commands.push_back(cmds.select_range + this->desired_.range);
+    if (!this->desired_.rate.empty() && this->desired_.rate != this->state_.rate && !cmds.select_rate.empty())
+      commands.push_back(cmds.select_rate + this->desired_.rate);
+    if (this->desired_.dual >= 0 && this->desired_.dual != this->state_.dual) {
+      const std::string &command = this->desired_.dual ? cmds.dual_on : cmds.dual_off;
+      if (!command.empty())
+        commands.push_back(command);
+    }
+
+    if (commands.empty()) {
+      ESP_LOGV("scpi_dmm", "State unchanged, write suppressed");
+      return;
+    }
+    // The function is committed by the switch transaction; the rest is assumed until the next poll
+    this->state_.auto_range = this->desired_.auto_range;
+    this->state_.range = this->desired_.range;
+    this->state_.rate = this->desired_.rate;
+    this->state_.dual = this->desired_.dual;
+    this->switch_to_(commands);
+  }
+
+  // Queues one round of state queries; the housekeeping budget paces them
+  void poll_state_() {
+    this->enqueue_(this->commands_.query_function, ResponseKind::FUNCTION, CommandPriority::HOUSEKEEPING);
+    this->enqueue_(this->commands_.query_auto_range, ResponseKind::AUTO_RANGE, CommandPriority::HOUSEKEEPING);
+    this->enqueue_(this->commands_.query_rate, ResponseKind::RATE, CommandPriority::HOUSEKEEPING);
+    this->enqueue_(this->commands_.query_range, ResponseKind::RANGE, CommandPriority::HOUSEKEEPING);
+    this->last_state_poll_ = millis();
+  }
+
+  void handle_state_response_(ResponseKind kind, const std::string &response) {
+    std::string text = response;
+    text.erase(std::remove(text.begin(), text.end(), '"'), text.end());
+    text.erase(0, text.find_first_not_of(' '));
+    text.erase(text.find_last_not_of(' ') + 1);
+    std::transform(text.begin(), text.end(), text.begin(), ::toupper);
+
+    InstrumentState previous = this->state_;
+    switch (kind) {
+      case ResponseKind::FUNCTION: {
+        // The XDM answers "VOLT" or "VOLT AC"; bare VOLT/CURR mean DC
+        std::replace(text.begin(), text.end(), ' ', ':');
+        if ((text == "VOLT" || text == "CURR"))
+          text += ":DC";
+        MeasurementFunction function = parse_function_(text);
+        if (function != MeasurementFunction::UNKNOWN)
+          this->state_.function = function;
+        break;
+      }
+      case ResponseKind::AUTO_RANGE:
+        if (text == "1" || text == "ON")
+          this->state_.auto_range = 1;
+        else if (text == "0" || text == "OFF")
+          this->state_.auto_range = 0;
+        break;
+      case ResponseKind::RATE:
+        if (!text.empty())
+          this->state_.rate = text.substr(0, 1);
+        break;
+      case ResponseKind::RANGE:
+        this->state_.range = text;
+        break;
+      default:
+        break;
+    }
+
+    if (previous.function != this->state_.function || previous.auto_range != this->state_.auto_range ||
+        previous.rate != this->state_.rate || previous.range != this->state_.range) {
+      ESP_LOGD("scpi_dmm", "Meter state changed: %s", response.c_str());
+      this->publish_state_();
+    }
+  }
+
+  void publish_state_() {
+    if (this->function_sensor != nullptr && this->state_.function != MeasurementFunction::UNKNOWN)
+      this->function_sensor->publish_state(function_to_string(this->state_.function));
+    if (this->range_sensor != nullptr && !this->state_.range.empty())
+      this->range_sensor->publish_state(this->state_.range);
+    // Publishing select states re-enters the select callbacks; skip while a write is pending
+    if (this->state_dirty_)
+      return;
+    const std::string *option = function_to_option_(this->state_.function);
+    if (this->function_select != nullptr && option != nullptr && this->function_select->state != *option)
+      this->function_select->publish_state(*option);
+    if (this->range_select != nullptr && this->state_.auto_range >= 0) {
+      const std::string &mode = RANGE_OPTIONS[this->state_.auto_range ? 0 : 1];
+      if (this->range_select->state != mode)
+        this->range_select->publish_state(mode);
+    }
+    if (this->rate_select != nullptr && !this->state_.rate.empty()) {
+      const std::string &mode = RATE_OPTIONS[this->state_.rate == "F" ? 1 : 0];
+      if (this->rate_select->state != mode)
+        this->rate_select->publish_state(mode);
+    }
+  }
+
+  void run_sequence_() {
+    const SequenceStep &step = this->sequence_[this->sequence_index_];
+    switch (this->sequence_state_) {
+      case SequenceState::APPLY: {
+        std::vector<std::string> commands;
+        if (!step.function_command.empty())
+          commands.push_back(step.function_command);
+        if (!step.range_command.empty())
+          commands.push_back(step.range_command);
+        // The switch transaction drains the in-flight reading so it is not attributed to this step
+        this->switch_to_(commands);
+        this->apply_step_range_(step);
+        this->sequence_skipped_ = 0;
+        this->sequence_taken_ = 0;
+        this->sequence_invalid_ = 0;
+        this->sequence_sum_ = 0.0f;
+        this->sequence_state_ = SequenceState::SETTLE;
+        break;
+      }
+      case SequenceState::SETTLE:
+        // The switch transaction already waited for a valid reading; settle_ms is extra margin
+        if (millis() - this->switch_completed_at_ < step.settle_ms)
+          return;
+        // A range command we could not interpret is read back before the step's readings
+        if (!step.range_command.empty() && this->state_.auto_range < 0) {
+          this->enqueue_(this->commands_.query_auto_range, ResponseKind::AUTO_RANGE, CommandPriority::CONFIGURATION);
+          this->enqueue_(this->commands_.query_range, ResponseKind::RANGE, CommandPriority::CONFIGURATION);
+        }
+        this->sequence_state_ = SequenceState::MEASURE;
+        // fallthrough
+      case SequenceState::MEASURE:
+        // Query back-to-back rather than on the free-running poll interval
+        if (!this->measurement_outstanding_())
+          this->query_measurement_();
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Steps send their range command as written; mirror it into the cached state like
+  // flush_state_ does, so calibration and the range entities follow the step
+  void apply_step_range_(const SequenceStep &step) {
+    if (step.range_command.empty())
+      return;
+    const DeviceCommands &cmds = this->commands_;
+    std::string command = step.range_command;
+    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+    if (!cmds.auto_range_on.empty() && command == cmds.auto_range_on) {
+      this->state_.auto_range = 1;
+    } else if (!cmds.auto_range_off.empty() && command == cmds.auto_range_off) {
+      this->state_.auto_range = 0;
+    } else if (!cmds.select_range.empty() && command.compare(0, cmds.select_range.size(), cmds.select_range) == 0) {
+      std::string range = command.substr(cmds.select_range.size());
+      range.erase(0, range.find_first_not_of(' '));
+      range.erase(range.find_last_not_of(' ') + 1);
+      this->state_.range = range;
+      this->state_.auto_range = 0;
+    } else {
+      // Unknown until it is read back once the switch has completed
+      this->state_.range.clear();
+      this->state_.auto_range = -1;
+    }
+    this->publish_state_();
+  }
+
+  void on_sequence_reading_(float value) {
+    if (this->sequence_state_ != SequenceState::MEASURE)
+      return;
+    const SequenceStep &step = this->sequence_[this->sequence_index_];
+    if (this->sequence_skipped_ < step.skip) {
+      this->sequence_skipped_++;
+      return;
+    }
+    this->sequence_sum_ += value;
+    this->sequence_taken_++;
+    if (this->sequence_taken_ < step.readings)
+      return;
+    this->finish_sequence_step_();
+  }
+
+  // A step that keeps getting non-numeric replies is closed with what it has (NaN if nothing)
+  void on_sequence_invalid_() {
+    if (this->sequence_state_ != SequenceState::MEASURE || ++this->sequence_invalid_ < SEQUENCE_MAX_INVALID)
+      return;
+    ESP_LOGW("scpi_dmm", "Sequence step %u got no valid reading", (unsigned) this->sequence_index_);
+    this->finish_sequence_step_();
+  }
+
+  void finish_sequence_step_() {
+    float value = this->sequence_taken_ > 0 ? this->sequence_sum_ / this->sequence_taken_ : NAN;
+    this->sequence_results_.push_back(SequenceResult{state_.function, value, this->sequence_taken_});
+    this->publish_sequence_step_(this->sequence_index_, this->sequence_results_.back());
+    this->sequence_state_ = SequenceState::APPLY;
+    if (++this->sequence_index_ < this->sequence_.size())
+      return;
+
+    this->publish_sequence_results_();
+    this->sequence_index_ = 0;
+    this->sequence_cycle_++;
+    this->sequence_results_.clear();
+    this->sequence_cycle_started_ = millis();
+  }
+
+  // One step per text sensor state: a whole cycle would overrun Home Assistant's
+  // 255-character limit from about five steps on
+  void publish_sequence_step_(size_t index, const SequenceResult &result) {
+    if (this->sequence_sensor == nullptr)
+      return;
+    this->sequence_sensor->publish_state(str_sprintf(
+        "{\"cycle\":%u,\"step\":%u,\"function\":\"%s\",\"value\":%s,\"count\":%u}", (unsigned) this->sequence_cycle_,
+        (unsigned) index, function_to_string(result.function), json_number_(result.value).c_str(),
+        (unsigned) result.count));
+  }
+
+  // The complete cycle goes out as a Home Assistant event, which has no length limit
+  void publish_sequence_results_() {
+    std::string results = "[";
+    for (size_t i = 0; i < this->sequence_results_.size(); i++) {
+      const SequenceResult &result = this->sequence_results_[i];
+      results += str_sprintf("%s{\"function\":\"%s\",\"value\":%s,\"count\":%u}", i == 0 ? "" : ",",
+                             function_to_string(result.function), json_number_(result.value).c_str(),
+                             (unsigned) result.count);
+    }
+    results += "]";
+    this->fire_homeassistant_event("esphome.scpi_dmm_sequence",
+                                   {{"source", to_string(this->source_)},
+                                    {"cycle", to_string(this->sequence_cycle_)},
+                                    {"duration_ms", to_string(millis() - this->sequence_cycle_started_)},
+                                    {"results", results}});
+    this->sequence_callback_.call(this->sequence_results_);
+  }
+
+  // A step without a single valid reading has no value; JSON has no NaN
+  static std::string json_number_(float value) {
+    return std::isnan(value) ? std::string("null") : str_sprintf("%g", value);
+  }
+
+  void switch_to_(const std::vector<std::string> &commands) {
+    // A tick or edge queued for the old function must not tag the first probe
+    this->due_pending_ = false;
+    // Reconfiguring stops continuous triggering on buffered meters
+    this->buffer_armed_ = false;
+    this->switch_commands_ = commands;
+    this->switch_function_ = this->state_.function;
+    for (const auto &command : commands) {
+      MeasurementFunction function = parse_function_(command);
+      if (function != MeasurementFunction::UNKNOWN)
+        this->switch_function_ = function;
+    }
+    this->switch_state_ = SwitchState::QUIESCE;
+  }
+
+  void run_switch_() {
+    const uint32_t now = millis();
+    switch (this->switch_state_) {
+      case SwitchState::QUIESCE:
+        // Queued polls would only return readings for the old function
+        this->scheduler_.clear(CommandPriority::MEASUREMENT);
+        if (this->query_pending_())
+          return;
+        // Anything still buffered belongs to the old function
+        this->rx_framer_.clear();
+        this->discard_rx_();
+        // Queued as one batch so no poll can land between the commands
+        for (const auto &command : this->switch_commands_)
+          this->enqueue_(command, ResponseKind::NONE, CommandPriority::CONFIGURATION);
+        this->state_.function = this->switch_function_;
+        this->switch_sent_at_ = now;
+        this->switch_discarded_ = 0;
+        this->switch_have_previous_ = false;
+        this->switch_state_ = SwitchState::SETTLE;
+        break;
+      case SwitchState::SETTLE: {
+        // The settle time counts from when the last command actually went out
+        if (this->scheduler_.has_pending(CommandPriority::CONFIGURATION)) {
+          this->switch_sent_at_ = now;
+          return;
+        }
+        // Start probing a little before the learned settle time so it can shrink again
+        uint32_t wait = this->learned_settle_ms_[static_cast<size_t>(this->switch_function_)] * 3 / 4;
+        if (now - this->switch_sent_at_ < wait)
+          return;
+        this->switch_state_ = SwitchState::VALIDATE;
+      }
+        // fallthrough
+      case SwitchState::VALIDATE:
+        if (!this->measurement_outstanding_())
+          this->query_measurement_();
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Returns true once the reading is valid for the new function
+  bool on_switch_reading_(float value) {
+    if (this->switch_state_ != SwitchState::VALIDATE)
+      return false;
+    const uint32_t now = millis();
+    bool timed_out = now - this->switch_sent_at_ >= this->settle_timeout_;
+    if (this->switch_discarded_ < this->switch_discard_ && !timed_out) {
+      this->switch_discarded_++;
+      return false;
+    }
+    bool stable = false;
+    if (this->switch_have_previous_) {
+      float diff = std::fabs(value - this->switch_previous_);
+      float scale = std::max(std::fabs(value), std::fabs(this->switch_previous_));
+      stable = diff <= scale * this->settle_tolerance_ || diff < 1e-9f;
+    }
+    if (!stable && !timed_out) {
+      this->switch_previous_ = value;
+      this->switch_previous_at_ = now;
+      this->switch_have_previous_ = true;
+      return false;
+    }
+
+    if (stable) {
+      // The first of the agreeing pair marks when the meter had settled
+      uint32_t observed = std::min<uint32_t>(this->switch_previous_at_ - this->switch_sent_at_, UINT16_MAX);
+      uint16_t &learned = this->learned_settle_ms_[static_cast<size_t>(this->switch_function_)];
+      learned = learned == 0 ? observed : (learned * 3 + observed) / 4;
+      ESP_LOGD("scpi_dmm", "%s settled after %u ms (learned %u ms)", function_to_string(this->switch_function_),
+               (unsigned) observed, (unsigned) learned);
+    } else {
+      ESP_LOGW("scpi_dmm", "%s did not settle within %u ms", function_to_string(this->switch_function_),
+               (unsigned) this->settle_timeout_);
+    }
+    this->complete_switch_();
+    return true;
+  }
+
+  // A non-numeric reply breaks the agreeing pair; past the timeout the switch ends anyway
+  void on_switch_invalid_() {
+    if (this->switch_state_ != SwitchState::VALIDATE)
+      return;
+    this->switch_have_previous_ = false;
+    if (millis() - this->switch_sent_at_ < this->settle_timeout_)
+      return;
+    ESP_LOGW("scpi_dmm", "%s gave no valid reading within %u ms", function_to_string(this->switch_function_),
+             (unsigned) this->settle_timeout_);
+    this->complete_switch_();
+  }
+
+  void complete_switch_() {
+    this->switch_state_ = SwitchState::IDLE;
+    this->switch_completed_at_ = millis();
+    if (this->function_sensor != nullptr) {
+      this->function_sensor->publish_state(function_to_string(this->state_.function));
+    }
+  }
+
+  // Replies beyond this are cut off; reading lists bypass the framer and are parsed as they stream in
+  static const size_t MAX_RESPONSE_LENGTH = 1024;
+  ResponseFramer rx_framer_{MAX_RESPONSE_LENGTH};
+  StreamPatternMatcher soft_start_;
+  LinkWatchdog watchdog_;
+  uint32_t soft_starts_{0};
+  static const size_t RX_CHUNK_SIZE = 64;
+  RxSource *rx_{nullptr};
+  std::unique_ptr<RxSource> own_rx_;
+  bool rx_events_{true};
+  InstrumentState state_;    // last state confirmed by the meter or written to it
+  InstrumentState desired_;  // requested state, flushed after the coalesce window
+  bool state_dirty_{false};
+  uint32_t state_dirty_at_{0};
+  uint32_t write_coalesce_{100};
+  uint32_t state_poll_interval_{10000};
+  uint32_t last_state_poll_{0};
+  DeviceCommands commands_;
+  std::string profile_;
+  bool auto_detect_{false};
+  ESPPreferenceObject profile_pref_;
+  uint32_t idn_hash_{0};  // IDN the current profile was detected from, 0 if none
+  uint32_t meter_idn_hash_{0};  // IDN of the meter currently answering, 0 until known
+  ESPPreferenceObject warm_pref_;
+  WarmState saved_warm_{};  // last state written, or the one loaded at boot
+  bool warm_pending_{false};  // running on the loaded state until *IDN? confirms the meter
+  bool state_unverified_{false};  // measuring waits until the meter confirms the loaded function
+  bool init_pending_{false};      // *RST and remote mode held until the rate is detected
   uint32_t last_query_{0};
-  static const uint32_t query_interval_{100}; // Query every 100ms
+  uint32_t query_interval_{100};
+  bool sample_clock_enabled_{false};
+  SampleClock sample_clock_;
+  std::unique_ptr<TriggerInput> trigger_input_;
+  std::unique_ptr<TriggerOutput> trigger_output_;
+  uint32_t due_us_{0};         // clock tick or trigger edge the next reading belongs to
+  bool due_pending_{false};    // its query is queued but not sent yet
+  bool timed_sample_{false};   // the query in flight belongs to a tick or edge
+  uint32_t due_ms_{0};         // due_us_ on the millis() timebase
+  static const uint32_t response_timeout_{500};
+  QueryInFlight query_;
+  CommandScheduler scheduler_;
+  SamplePipeline own_pipeline_;
+  SamplePipeline *pipeline_{&own_pipeline_};
+  uint8_t source_{0};
+  std::unique_ptr<HistoryRing> history_;
+  std::unique_ptr<LiveStream> live_stream_;
+  Metrics metrics_;
+#ifdef USE_SCPI_DMM_DATALOG
+  std::unique_ptr<FlashLogger> datalog_;
+#endif
+  uint32_t last_metrics_update_{0};
+  static const uint32_t METRICS_UPDATE_INTERVAL = 1000;
+  // Home Assistant events are size limited; use the HTTP endpoint for more
+  static const size_t HISTORY_EVENT_MAX_POINTS = 200;
+#ifdef USE_TIME
+  time::RealTimeClock *clock_{nullptr};
+#endif
+#ifdef USE_MQTT
+  std::unique_ptr<MQTTBridge> mqtt_bridge_;
+  std::unique_ptr<MQTTSampleStream> mqtt_stream_;
+#endif
+  uint32_t interactive_latency_budget_{250};
+  uint32_t rx_activity_at_{0};
+
+  // Buffered acquisition
+  bool buffered_enabled_{true};
+  bool buffer_armed_{false};
+  uint32_t buffer_fetch_interval_{200};
+  uint32_t buffer_window_start_{0};
+  uint32_t buffer_reading_interval_{0};  // estimated from the previous batch
+  float buffer_last_value_{NAN};
+  ReadingListParser reading_parser_;
+
+  // Function/range switch transaction
+  SwitchState switch_state_{SwitchState::IDLE};
+  BaudRates baud_rates_;
+  bool baud_autodetect_{false};
+  bool baud_negotiate_{false};
+  uint8_t baud_verify_count_{10};
+  std::string baud_command_override_;
+  BaudState baud_state_{BaudState::IDLE};
+  bool baud_reverting_{false};
+  uint32_t baud_from_{0};
+  uint32_t baud_target_{0};
+  uint32_t baud_changed_at_{0};
+  uint8_t verify_left_{0};
+  uint8_t detect_left_{0};  // rates still to try right away before leaving it to the watchdog
+  static const uint32_t BAUD_SETTLE_MS = 100;  // meters need a moment before listening at the new rate
+  std::vector<std::string> switch_commands_;
+  MeasurementFunction switch_function_{MeasurementFunction::UNKNOWN};
+  uint32_t switch_sent_at_{0};
+  uint32_t switch_completed_at_{0};
+  uint32_t switch_previous_at_{0};
+  float switch_previous_{0.0f};
+  bool switch_have_previous_{false};
+  uint8_t switch_discarded_{0};
+  uint8_t switch_discard_{1};     // wait_after_func quirk: first reading after a switch is stale
+  float settle_tolerance_{0.01f};  // relative agreement of consecutive readings
+  uint32_t settle_timeout_{3000};
+  std::array<uint16_t, FUNCTION_COUNT> learned_settle_ms_{};
+  Calibration calibration_;
+  const CalibrationTransform *active_calibration_{nullptr};
+  std::array<float, FUNCTION_COUNT> zero_offset_{};  // relative zero per function, 0 when off
+  float last_corrected_{NAN};                         // latest calibrated reading, before the zero
+  MeasurementFunction last_corrected_function_{MeasurementFunction::UNKNOWN};
+
+  // On-device measurement sequence
+  std::vector<SequenceStep> sequence_;
+  std::vector<SequenceResult> sequence_results_;
+  SequenceState sequence_state_{SequenceState::IDLE};
+  bool sequence_autostart_{false};
+  size_t sequence_index_{0};
+  uint32_t sequence_cycle_{0};
+  uint32_t sequence_cycle_started_{0};
+  uint8_t sequence_skipped_{0};
+  uint8_t sequence_taken_{0};
+  uint8_t sequence_invalid_{0};  // non-numeric replies in the current step
+  static const uint8_t SEQUENCE_MAX_INVALID = 3;
+  float sequence_sum_{0.0f};
+  CallbackManager<void(const std::vector<SequenceResult> &)> sequence_callback_;
 };
+
+}  // namespace scpi_dmm
+}  // namespace esphome
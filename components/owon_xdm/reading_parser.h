@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Payload encoding of definite-length blocks, as selected with FORM:DATA
+enum class ReadingFormat : uint8_t {
+  ASCII,   // comma-separated numbers
+  REAL32,  // IEEE 754 single precision
+  REAL64   // IEEE 754 double precision
+};
+
+inline size_t reading_format_size(ReadingFormat format) {
+  return format == ReadingFormat::REAL32 ? 4 : format == ReadingFormat::REAL64 ? 8 : 0;
+}
+
+// Decodes one binary value; big-endian unless swapped (FORM:BORD SWAP)
+inline float decode_real(const uint8_t *bytes, ReadingFormat format, bool swapped) {
+  size_t size = reading_format_size(format);
+  uint8_t ordered[8];
+  for (size_t i = 0; i < size; i++) {
+    // Assemble little-endian, as on the ESP32
+    ordered[i] = swapped ? bytes[i] : bytes[size - 1 - i];
+  }
+  if (format == ReadingFormat::REAL64) {
+    double value;
+    memcpy(&value, ordered, sizeof(value));
+    return value;
+  }
+  float value;
+  memcpy(&value, ordered, sizeof(value));
+  return value;
+}
+
+// Incremental decoder for the reading lists returned by buffer queries (R?, FETC?,
+// DATA:REM?). Accepts
+//   1.234E+00,1.235E+00,...\n                  a plain comma-separated list
+//   #3024<24 bytes of comma-separated list>\n  an IEEE 488.2 definite-length block
+//   #18<2 x REAL32>\n                          a binary block, see set_format()
+// Bytes are fed one at a time as they come off the UART and every value is emitted
+// as soon as it is complete, so memory use does not grow with the response. Binary
+// payloads may contain any byte, LF included; only the block length ends them.
+class ReadingListParser {
+ public:
+  enum class Result : uint8_t { MORE, DONE, ERROR };
+
+  // Payload encoding expected inside definite-length blocks
+  void set_format(ReadingFormat format, bool swapped = false) {
+    this->format_ = format;
+    this->swapped_ = swapped;
+  }
+
+  void reset() {
+    this->state_ = State::START;
+    this->token_length_ = 0;
+    this->count_ = 0;
+  }
+
+  // Number of values emitted since reset()
+  uint32_t get_count() const { return this->count_; }
+
+  template<typename F> Result feed(uint8_t c, F &&emit) {
+    switch (this->state_) {
+      case State::START:
+        if (c == '#') {
+          this->state_ = State::BLOCK_DIGITS;
+          return Result::MORE;
+        }
+        if (c == ' ' || c == '\r')
+          return Result::MORE;
+        if (c == '\n')
+          return Result::DONE;
+        this->state_ = State::LIST;
+        this->list_byte_(c, emit);
+        return Result::MORE;
+
+      case State::BLOCK_DIGITS:
+        if (c < '0' || c > '9')
+          return Result::ERROR;
+        this->digits_ = c - '0';
+        this->remaining_ = 0;
+        this->token_length_ = 0;
+        if (this->digits_ == 0) {
+          // "#0" is an indefinite-length block, terminated by LF; binary data cannot be framed that way
+          if (this->format_ != ReadingFormat::ASCII)
+            return Result::ERROR;
+          this->state_ = State::LIST;
+        } else {
+          this->state_ = State::BLOCK_LENGTH;
+        }
+        return Result::MORE;
+
+      case State::BLOCK_LENGTH:
+        if (c < '0' || c > '9')
+          return Result::ERROR;
+        this->remaining_ = this->remaining_ * 10 + (c - '0');
+        if (--this->digits_ == 0)
+          this->state_ = this->remaining_ > 0 ? State::BLOCK_DATA : State::TRAILER;
+        return Result::MORE;
+
+      case State::BLOCK_DATA:
+        if (this->format_ == ReadingFormat::ASCII) {
+          this->list_byte_(c, emit);
+        } else {
+          this->binary_byte_(c, emit);
+        }
+        if (--this->remaining_ == 0) {
+          this->flush_token_(emit);
+          this->state_ = State::TRAILER;
+        }
+        return Result::MORE;
+
+      case State::TRAILER:
+        return c == '\n' ? Result::DONE : Result::MORE;
+
+      case State::LIST:
+        if (c == '\n') {
+          this->flush_token_(emit);
+          return Result::DONE;
+        }
+        this->list_byte_(c, emit);
+        return Result::MORE;
+    }
+    return Result::ERROR;
+  }
+
+ protected:
+  enum class State : uint8_t { START, BLOCK_DIGITS, BLOCK_LENGTH, BLOCK_DATA, TRAILER, LIST };
+
+  template<typename F> void list_byte_(uint8_t c, F &&emit) {
+    if (c == ',') {
+      this->flush_token_(emit);
+    } else if (c != ' ' && c != '\r' && c != '\n' && this->token_length_ < sizeof(this->token_) - 1) {
+      this->token_[this->token_length_++] = c;
+    }
+  }
+
+  template<typename F> void binary_byte_(uint8_t c, F &&emit) {
+    this->token_[this->token_length_++] = c;
+    if (this->token_length_ < reading_format_size(this->format_))
+      return;
+    this->token_length_ = 0;
+    this->count_++;
+    emit(decode_real(reinterpret_cast<const uint8_t *>(this->token_), this->format_, this->swapped_));
+  }
+
+  template<typename F> void flush_token_(F &&emit) {
+    // A binary block that ends mid-value leaves a partial token behind; drop it
+    if (this->format_ != ReadingFormat::ASCII && this->state_ == State::BLOCK_DATA) {
+      this->token_length_ = 0;
+      return;
+    }
+    if (this->token_length_ == 0)
+      return;
+    this->token_[this->token_length_] = '\0';
+    this->token_length_ = 0;
+    char *end;
+    float value = strtof(this->token_, &end);
+    if (end == this->token_)
+      return;
+    this->count_++;
+    emit(value);
+  }
+
+  State state_{State::START};
+  ReadingFormat format_{ReadingFormat::ASCII};
+  bool swapped_{false};
+  uint8_t digits_{0};
+  uint32_t remaining_{0};
+  char token_[24];  // ASCII number, or the bytes of one binary value
+  uint8_t token_length_{0};
+  uint32_t count_{0};
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
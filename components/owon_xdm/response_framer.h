@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Splits the UART byte stream into replies: LF-terminated lines (CR ignored), or
+// IEEE 488.2 definite-length blocks "#<n><length><payload>" whose payload may hold
+// any byte, LF included. The reply is capped at max_length; the excess is dropped and
+// the reply flagged as truncated, so a runaway or mis-framed reply cannot eat the heap.
+class ResponseFramer {
+ public:
+  explicit ResponseFramer(size_t max_length = 1024) : max_length_(max_length) {}
+
+  // True when a complete reply is available through get()
+  bool feed(uint8_t c) {
+    switch (this->state_) {
+      case State::LINE:
+        if (c == '\n')
+          return !this->reply_.empty() || this->truncated_;
+        if (c == '\r')
+          return false;
+        if (c == '#' && this->reply_.empty() && !this->truncated_) {
+          // The header is kept as text until it is known to be one
+          this->reply_ += '#';
+          this->state_ = State::BLOCK_DIGITS;
+          return false;
+        }
+        this->append_(c);
+        return false;
+
+      case State::BLOCK_DIGITS:
+        if (c == '0') {
+          // "#0" is an indefinite-length block, terminated by LF like a line
+          this->reply_.clear();
+          this->block_ = true;
+          this->state_ = State::LINE;
+          return false;
+        }
+        if (c < '1' || c > '9')
+          return this->fall_back_(c);
+        this->reply_ += static_cast<char>(c);
+        this->digits_ = c - '0';
+        this->remaining_ = 0;
+        this->state_ = State::BLOCK_LENGTH;
+        return false;
+
+      case State::BLOCK_LENGTH:
+        if (c < '0' || c > '9')
+          return this->fall_back_(c);
+        this->reply_ += static_cast<char>(c);
+        this->remaining_ = this->remaining_ * 10 + (c - '0');
+        if (--this->digits_ == 0) {
+          this->reply_.clear();
+          this->block_ = true;
+          this->state_ = this->remaining_ > 0 ? State::BLOCK_DATA : State::TRAILER;
+        }
+        return false;
+
+      case State::BLOCK_DATA:
+        this->append_(c);
+        if (--this->remaining_ == 0)
+          this->state_ = State::TRAILER;
+        return false;
+
+      case State::TRAILER:
+        return c == '\n';
+    }
+    return false;
+  }
+
+  // The reply: the line, or the block payload without its header
+  const std::string &get() const { return this->reply_; }
+  bool is_block() const { return this->block_; }
+  bool is_truncated() const { return this->truncated_; }
+
+  void clear() {
+    this->reply_.clear();
+    this->state_ = State::LINE;
+    this->block_ = false;
+    this->truncated_ = false;
+  }
+
+ protected:
+  enum class State : uint8_t { LINE, BLOCK_DIGITS, BLOCK_LENGTH, BLOCK_DATA, TRAILER };
+
+  void append_(uint8_t c) {
+    if (this->reply_.size() < this->max_length_) {
+      this->reply_ += static_cast<char>(c);
+    } else {
+      this->truncated_ = true;
+    }
+  }
+
+  // Not a block after all ("#ERR..."): carry on with the header as ordinary text
+  bool fall_back_(uint8_t c) {
+    this->state_ = State::LINE;
+    return this->feed(c);
+  }
+
+  size_t max_length_;
+  State state_{State::LINE};
+  std::string reply_;
+  uint8_t digits_{0};
+  uint32_t remaining_{0};
+  bool block_{false};
+  bool truncated_{false};
+};
+
+// Finds a fixed byte sequence in a stream, one byte at a time (KMP), e.g. the bytes a
+// meter emits when it powers up. Outside a partial match a byte costs one comparison.
+class StreamPatternMatcher {
+ public:
+  void set_pattern(const std::string &pattern) {
+    this->pattern_ = pattern;
+    this->matched_ = 0;
+    this->fallback_.assign(pattern.size(), 0);
+    for (size_t i = 1, k = 0; i < pattern.size(); i++) {
+      while (k > 0 && pattern[i] != pattern[k])
+        k = this->fallback_[k - 1];
+      if (pattern[i] == pattern[k])
+        k++;
+      this->fallback_[i] = k;
+    }
+  }
+
+  // True when c completes the pattern
+  bool feed(uint8_t c) {
+    if (this->matched_ == 0 && (this->pattern_.empty() || c != static_cast<uint8_t>(this->pattern_[0])))
+      return false;
+    while (this->matched_ > 0 && c != static_cast<uint8_t>(this->pattern_[this->matched_]))
+      this->matched_ = this->fallback_[this->matched_ - 1];
+    if (c == static_cast<uint8_t>(this->pattern_[this->matched_]))
+      this->matched_++;
+    if (this->matched_ < this->pattern_.size())
+      return false;
+    this->matched_ = 0;
+    return true;
+  }
+
+  void reset() { this->matched_ = 0; }
+
+ protected:
+  std::string pattern_;
+  std::vector<size_t> fallback_;  // longest proper prefix that is also a suffix of pattern_[0..i]
+  size_t matched_{0};
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
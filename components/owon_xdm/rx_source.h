@@ -0,0 +1,151 @@
+#pragma once
+
+#include "esphome/components/uart/uart.h"
+#ifdef USE_ESP_IDF
+#include "esphome/components/uart/uart_component_esp_idf.h"
+#include "esphome/core/application.h"
+#include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// Where the meter's bytes come from. SCPIDMM only pulls received bytes through this
+// interface, so a host build can drive the protocol logic with a scripted source.
+class RxSource {
+ public:
+  virtual ~RxSource() = default;
+  // False when the source cannot work on this hardware; the caller falls back to polling
+  virtual bool start() { return true; }
+  // True when read() may return bytes. Runs on every loop, so it must be cheap.
+  virtual bool ready() = 0;
+  // Copies up to max_len received bytes without blocking
+  virtual size_t read(uint8_t *buffer, size_t max_len) = 0;
+};
+
+// Asks the UART driver for buffered bytes on every loop
+class PolledRxSource : public RxSource {
+ public:
+  explicit PolledRxSource(uart::UARTDevice *device) : device_(device) {}
+
+  bool ready() override { return this->device_->available() > 0; }
+
+  size_t read(uint8_t *buffer, size_t max_len) override {
+    int available = this->device_->available();
+    size_t count = std::min<size_t>(available > 0 ? available : 0, max_len);
+    if (count == 0 || !this->device_->read_array(buffer, count))
+      return 0;
+    return count;
+  }
+
+ protected:
+  uart::UARTDevice *device_;
+};
+
+// Replays bytes handed to feed(); for host builds and tests
+class BufferRxSource : public RxSource {
+ public:
+  void feed(const std::string &data) { this->data_ += data; }
+
+  bool ready() override { return this->position_ < this->data_.size(); }
+
+  size_t read(uint8_t *buffer, size_t max_len) override {
+    size_t count = std::min(max_len, this->data_.size() - this->position_);
+    memcpy(buffer, this->data_.data() + this->position_, count);
+    this->position_ += count;
+    if (this->position_ == this->data_.size()) {
+      this->data_.clear();
+      this->position_ = 0;
+    }
+    return count;
+  }
+
+ protected:
+  std::string data_;
+  size_t position_{0};
+};
+
+#ifdef USE_ESP_IDF
+// Lets the UART hardware report when there is something to read. Pattern detection
+// interrupts on every LF, so a reply is noticed as soon as its line is complete, and the
+// RX timeout interrupt covers data that does not end in LF (long binary blocks filling
+// the FIFO, a prompt). A small task waits on the driver's event queue and raises a flag;
+// an idle loop then costs one atomic load instead of a locked driver call. The bytes
+// themselves are still read through the UART component in the main loop.
+class ESP32EventRxSource : public PolledRxSource {
+ public:
+  ESP32EventRxSource(uart::UARTDevice *device, uart::IDFUARTComponent *uart) : PolledRxSource(device), uart_(uart) {}
+
+  bool start() override {
+    // ESPHome creates the event queue when installing the driver but does not consume it
+    this->queue_ = *this->uart_->get_uart_event_queue();
+    if (this->queue_ == nullptr)
+      return false;
+    this->port_ = static_cast<uart_port_t>(this->uart_->get_hw_serial_number());
+    if (uart_enable_pattern_det_baud_intr(this->port_, '\n', 1, 9, 0, 0) != ESP_OK)
+      return false;
+    uart_pattern_queue_reset(this->port_, PATTERN_QUEUE_LENGTH);
+    // Whatever arrived before the task existed raised no event
+    this->pending_.store(true, std::memory_order_release);
+    return xTaskCreate(&ESP32EventRxSource::event_task_, "scpi_dmm_rx", 2048, this, 12, nullptr) == pdPASS;
+  }
+
+  bool ready() override { return this->pending_.load(std::memory_order_acquire); }
+
+  size_t read(uint8_t *buffer, size_t max_len) override {
+    // Cleared before reading: bytes landing after this raise a fresh event
+    this->pending_.store(false, std::memory_order_release);
+    size_t count = PolledRxSource::read(buffer, max_len);
+    if (count == max_len)
+      this->pending_.store(true, std::memory_order_release);
+    return count;
+  }
+
+  uint32_t get_overflows() const { return this->overflows_.load(std::memory_order_relaxed); }
+
+ protected:
+  static const int PATTERN_QUEUE_LENGTH = 8;
+
+  static void event_task_(void *arg) {
+    auto *self = static_cast<ESP32EventRxSource *>(arg);
+    uart_event_t event;
+    for (;;) {
+      if (xQueueReceive(self->queue_, &event, portMAX_DELAY) != pdTRUE)
+        continue;
+      switch (event.type) {
+        case UART_PATTERN_DET:
+          // Only the wake-up matters; drop the position so the pattern queue never fills
+          uart_pattern_pop_pos(self->port_);
+          break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          self->overflows_.fetch_add(1, std::memory_order_relaxed);
+          break;
+        default:
+          break;
+      }
+      self->pending_.store(true, std::memory_order_release);
+#ifdef USE_WAKE_LOOP_THREADSAFE
+      App.wake_loop_threadsafe();
+#endif
+    }
+  }
+
+  uart::IDFUARTComponent *uart_;
+  uart_port_t port_{UART_NUM_0};
+  QueueHandle_t queue_{nullptr};
+  std::atomic<bool> pending_{false};
+  std::atomic<uint32_t> overflows_{0};
+};
+#endif  // USE_ESP_IDF
+
+}  // namespace scpi_dmm
+}  // namespace esphome
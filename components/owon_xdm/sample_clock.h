@@ -0,0 +1,109 @@
+#pragma once
+
+#include "esphome/core/hal.h"
+#ifdef USE_ESP32
+#include "esphome/core/application.h"
+#include <esp_timer.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// How far actual query times fell behind the grid
+struct ClockStats {
+  uint32_t samples{0};
+  uint32_t missed{0};  // ticks that passed while the previous query was still busy
+  uint64_t jitter_sum_us{0};
+  uint32_t jitter_max_us{0};
+};
+
+// Acquisition grid: tick n is due at origin + n * interval, so late ticks never push the
+// following ones back and the spacing does not drift. On the ESP32 a periodic esp_timer
+// counts the ticks; elsewhere they are derived from micros(). All times are micros().
+class SampleClock {
+ public:
+  void start(uint32_t interval_ms) {
+    this->interval_us_ = interval_ms * 1000;
+    this->origin_us_ = micros();
+    this->next_us_ = this->origin_us_ + this->interval_us_;
+    this->consumed_ = 0;
+    this->ticks_.store(0, std::memory_order_relaxed);
+#ifdef USE_ESP32
+    esp_timer_create_args_t args{};
+    args.callback = &SampleClock::on_timer_;
+    args.arg = this;
+    args.name = "scpi_dmm_clock";
+    if (esp_timer_create(&args, &this->timer_) == ESP_OK &&
+        esp_timer_start_periodic(this->timer_, this->interval_us_) == ESP_OK) {
+      this->hardware_ = true;
+    }
+#endif
+    this->running_ = true;
+  }
+
+  bool is_running() const { return this->running_; }
+  bool is_hardware() const { return this->hardware_; }
+
+  // True when a tick is due; scheduled_us is its grid time. When several ticks passed
+  // since the last call only the latest one is returned and the rest count as missed.
+  bool take_tick(uint32_t &scheduled_us) {
+    if (this->hardware_) {
+      uint32_t ticks = this->ticks_.load(std::memory_order_acquire);
+      if (ticks == this->consumed_)
+        return false;
+      this->stats_.missed += ticks - this->consumed_ - 1;
+      this->consumed_ = ticks;
+      scheduled_us = this->origin_us_ + ticks * this->interval_us_;
+      return true;
+    }
+    // Differences only, micros() wraps every 71 minutes
+    uint32_t late = micros() - this->next_us_;
+    if (static_cast<int32_t>(late) < 0)
+      return false;
+    uint32_t skipped = late / this->interval_us_;
+    this->stats_.missed += skipped;
+    scheduled_us = this->next_us_ + skipped * this->interval_us_;
+    this->next_us_ = scheduled_us + this->interval_us_;
+    return true;
+  }
+
+  // Records when the query for the tick scheduled at scheduled_us actually went out
+  void record(uint32_t scheduled_us, uint32_t actual_us) {
+    uint32_t jitter = actual_us - scheduled_us;
+    this->stats_.samples++;
+    this->stats_.jitter_sum_us += jitter;
+    if (jitter > this->stats_.jitter_max_us)
+      this->stats_.jitter_max_us = jitter;
+  }
+
+  const ClockStats &get_stats() const { return this->stats_; }
+
+ protected:
+#ifdef USE_ESP32
+  // Runs in the esp_timer task
+  static void on_timer_(void *arg) {
+    auto *self = static_cast<SampleClock *>(arg);
+    self->ticks_.fetch_add(1, std::memory_order_release);
+#ifdef USE_WAKE_LOOP_THREADSAFE
+    App.wake_loop_threadsafe();
+#endif
+  }
+
+  esp_timer_handle_t timer_{nullptr};
+#endif
+
+  uint32_t interval_us_{0};
+  uint32_t origin_us_{0};
+  uint32_t next_us_{0};   // software grid: next tick due
+  uint32_t consumed_{0};  // hardware grid: ticks handed out
+  std::atomic<uint32_t> ticks_{0};
+  bool hardware_{false};
+  bool running_{false};
+  ClockStats stats_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
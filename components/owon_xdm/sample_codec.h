@@ -0,0 +1,186 @@
+#pragma once
+
+#include "sample_pipeline.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace esphome {
+namespace scpi_dmm {
+
+static const size_t SAMPLE_BLOCK_BYTES = 512;
+
+// A run of samples of one function and source, compressed Gorilla-style:
+//   timestamps: delta-of-delta, '0' | '10'+7 bits | '110'+9 bits | '1110'+12 bits | '1111'+32 bits
+//   values:     XOR with the previous float, '0' for a repeat, '10' + bits inside the previous
+//               leading/trailing-zero window, or '11' + 5-bit leading zeros + 5-bit length + bits
+// The first sample is stored raw, so each block decodes on its own. A slowly changing
+// reading costs a few bits per sample instead of the 12 bytes of a raw Sample.
+struct SampleBlock {
+  uint32_t first_ms{0};
+  uint32_t last_ms{0};
+  uint32_t first_bits{0};
+  uint16_t count{0};
+  uint16_t bit_length{0};
+  MeasurementFunction function{MeasurementFunction::UNKNOWN};
+  uint8_t source{0};
+  uint8_t data[SAMPLE_BLOCK_BYTES];
+
+  size_t data_bytes() const { return (this->bit_length + 7) / 8; }
+};
+
+// Appends samples to a SampleBlock; holds the running state of the block being written
+class SampleBlockEncoder {
+ public:
+  void start(SampleBlock &block, const Sample &sample) {
+    block.first_ms = block.last_ms = sample.timestamp_ms;
+    block.first_bits = float_bits(sample.value);
+    block.count = 1;
+    block.bit_length = 0;
+    block.function = sample.function;
+    block.source = sample.source;
+    memset(block.data, 0, sizeof(block.data));
+    this->prev_delta_ = 0;
+    this->prev_bits_ = block.first_bits;
+    this->prev_leading_ = NO_WINDOW;
+    this->prev_trailing_ = 0;
+  }
+
+  // False when the sample belongs in a new block: other function or source, time
+  // going backwards, or no room left
+  bool append(SampleBlock &block, const Sample &sample) {
+    if (block.count == 0 || block.count == UINT16_MAX || block.function != sample.function ||
+        block.source != sample.source || sample.timestamp_ms < block.last_ms ||
+        size_t(block.bit_length) + MAX_SAMPLE_BITS > SAMPLE_BLOCK_BYTES * 8)
+      return false;
+
+    int32_t delta = sample.timestamp_ms - block.last_ms;
+    int32_t dod = delta - this->prev_delta_;
+    if (dod == 0) {
+      write_bits_(block, 0b0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+      write_bits_(block, 0b10, 2);
+      write_bits_(block, dod + 63, 7);
+    } else if (dod >= -255 && dod <= 256) {
+      write_bits_(block, 0b110, 3);
+      write_bits_(block, dod + 255, 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+      write_bits_(block, 0b1110, 4);
+      write_bits_(block, dod + 2047, 12);
+    } else {
+      write_bits_(block, 0b1111, 4);
+      write_bits_(block, static_cast<uint32_t>(dod), 32);
+    }
+    this->prev_delta_ = delta;
+
+    uint32_t bits = float_bits(sample.value);
+    uint32_t x = bits ^ this->prev_bits_;
+    if (x == 0) {
+      write_bits_(block, 0b0, 1);
+    } else {
+      uint8_t leading = std::min(__builtin_clz(x), 31);
+      uint8_t trailing = __builtin_ctz(x);
+      if (this->prev_leading_ != NO_WINDOW && leading >= this->prev_leading_ && trailing >= this->prev_trailing_) {
+        write_bits_(block, 0b10, 2);
+        write_bits_(block, x >> this->prev_trailing_, 32 - this->prev_leading_ - this->prev_trailing_);
+      } else {
+        uint8_t length = 32 - leading - trailing;
+        write_bits_(block, 0b11, 2);
+        write_bits_(block, leading, 5);
+        write_bits_(block, length - 1, 5);
+        write_bits_(block, x >> trailing, length);
+        this->prev_leading_ = leading;
+        this->prev_trailing_ = trailing;
+      }
+    }
+    this->prev_bits_ = bits;
+    block.last_ms = sample.timestamp_ms;
+    block.count++;
+    return true;
+  }
+
+  static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  static float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+ protected:
+  // Worst case: 4+32 bits of timestamp and 2+5+5+32 bits of value
+  static const uint16_t MAX_SAMPLE_BITS = 80;
+  static const uint8_t NO_WINDOW = 0xFF;
+
+  static void write_bits_(SampleBlock &block, uint32_t value, uint8_t bits) {
+    for (int i = bits - 1; i >= 0; i--, block.bit_length++) {
+      if ((value >> i) & 1)
+        block.data[block.bit_length >> 3] |= 0x80 >> (block.bit_length & 7);
+    }
+  }
+
+  int32_t prev_delta_{0};
+  uint32_t prev_bits_{0};
+  uint8_t prev_leading_{NO_WINDOW};
+  uint8_t prev_trailing_{0};
+};
+
+// Decodes count samples from a block's bit stream; stops early when emit returns false
+template<typename F>
+void decode_sample_block(uint32_t first_ms, uint32_t first_bits, uint16_t count, MeasurementFunction function,
+                         uint8_t source, const uint8_t *data, F &&emit) {
+  uint32_t pos = 0;
+  auto read = [&](uint8_t bits) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bits; i++, pos++)
+      value = (value << 1) | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+    return value;
+  };
+
+  uint32_t timestamp = first_ms;
+  uint32_t bits = first_bits;
+  int32_t delta = 0;
+  uint8_t leading = 0, trailing = 0;
+  if (count == 0 || !emit(Sample{timestamp, SampleBlockEncoder::bits_float(bits), function, source}))
+    return;
+  for (uint16_t n = 1; n < count; n++) {
+    int32_t dod;
+    if (read(1) == 0) {
+      dod = 0;
+    } else if (read(1) == 0) {
+      dod = int32_t(read(7)) - 63;
+    } else if (read(1) == 0) {
+      dod = int32_t(read(9)) - 255;
+    } else if (read(1) == 0) {
+      dod = int32_t(read(12)) - 2047;
+    } else {
+      dod = static_cast<int32_t>(read(32));
+    }
+    delta += dod;
+    timestamp += delta;
+
+    if (read(1) == 1) {
+      if (read(1) == 1) {
+        leading = read(5);
+        uint8_t length = read(5) + 1;
+        trailing = 32 - leading - length;
+      }
+      bits ^= read(32 - leading - trailing) << trailing;
+    }
+    if (!emit(Sample{timestamp, SampleBlockEncoder::bits_float(bits), function, source}))
+      return;
+  }
+}
+
+template<typename F> void decode_sample_block(const SampleBlock &block, F &&emit) {
+  decode_sample_block(block.first_ms, block.first_bits, block.count, block.function, block.source, block.data,
+                      std::forward<F>(emit));
+}
+
+}  // namespace scpi_dmm
+}  // namespace esphome
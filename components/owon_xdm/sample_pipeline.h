@@ -0,0 +1,67 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+
+#include <cstdint>
+#include <functional>
+
+namespace esphome {
+namespace scpi_dmm {
+
+enum class MeasurementFunction {
+  VOLTAGE_DC,
+  VOLTAGE_AC,
+  CURRENT_DC,
+  CURRENT_AC,
+  RESISTANCE,
+  CONTINUITY,
+  DIODE,
+  FREQUENCY,
+  TEMPERATURE,
+  CAPACITANCE,
+  DERIVED,  // computed by a DerivedChannel, not read from a meter
+  UNKNOWN
+};
+
+static const size_t FUNCTION_COUNT = static_cast<size_t>(MeasurementFunction::UNKNOWN) + 1;
+
+// SCPI mnemonic for a measurement function, used in result payloads
+inline const char *function_to_string(MeasurementFunction function) {
+  switch (function) {
+    case MeasurementFunction::VOLTAGE_DC: return "VOLT:DC";
+    case MeasurementFunction::VOLTAGE_AC: return "VOLT:AC";
+    case MeasurementFunction::CURRENT_DC: return "CURR:DC";
+    case MeasurementFunction::CURRENT_AC: return "CURR:AC";
+    case MeasurementFunction::RESISTANCE: return "RES";
+    case MeasurementFunction::CONTINUITY: return "CONT";
+    case MeasurementFunction::DIODE: return "DIOD";
+    case MeasurementFunction::FREQUENCY: return "FREQ";
+    case MeasurementFunction::TEMPERATURE: return "TEMP";
+    case MeasurementFunction::CAPACITANCE: return "CAP";
+    case MeasurementFunction::DERIVED: return "DERIVED";
+    default: return "UNKNOWN";
+  }
+}
+
+// One valid reading as it leaves the acquisition path
+struct Sample {
+  uint32_t timestamp_ms;  // millis() when the reading was framed, or its grid time with the sample clock
+  float value;
+  MeasurementFunction function;
+  uint8_t source;  // instrument index, 0 for single-meter nodes
+  uint32_t actual_ms{0};  // millis() when the reading was requested
+};
+
+// Fans every sample out to the registered sinks (streams, history, loggers, ...).
+// Sinks run synchronously in the acquisition path and must not block.
+class SamplePipeline {
+ public:
+  void add_sink(std::function<void(const Sample &)> &&sink) { this->sinks_.add(std::move(sink)); }
+  void push(const Sample &sample) { this->sinks_.call(sample); }
+
+ protected:
+  CallbackManager<void(const Sample &)> sinks_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "esphome/core/gpio.h"
+#include "esphome/core/hal.h"
+
+#include <cstdint>
+
+namespace esphome {
+namespace scpi_dmm {
+
+// An edge on a GPIO, latched with its micros() time in the interrupt and picked up by
+// the loop. The edge time, not the loop that noticed it, becomes the sample time.
+class TriggerInput {
+ public:
+  TriggerInput(InternalGPIOPin *pin, gpio::InterruptType edge) : pin_(pin), edge_(edge) {}
+
+  void setup() {
+    this->pin_->setup();
+    this->pin_->attach_interrupt(&TriggerInput::isr_, this, this->edge_);
+  }
+
+  // True once for each new edge; edges arriving before the previous one was taken are
+  // counted as missed and only the latest is returned
+  bool take(uint32_t &edge_us) {
+    uint32_t count = this->count_;
+    if (count == this->taken_)
+      return false;
+    edge_us = this->edge_us_;
+    this->missed_ += count - this->taken_ - 1;
+    this->taken_ = count;
+    return true;
+  }
+
+  uint32_t get_edges() const { return this->count_; }
+  uint32_t get_missed() const { return this->missed_; }
+
+ protected:
+  static void IRAM_ATTR isr_(TriggerInput *self) {
+    self->edge_us_ = micros();
+    self->count_ = self->count_ + 1;
+  }
+
+  InternalGPIOPin *pin_;
+  gpio::InterruptType edge_;
+  volatile uint32_t edge_us_{0};
+  volatile uint32_t count_{0};
+  uint32_t taken_{0};
+  uint32_t missed_{0};
+};
+
+// Pulses a GPIO when a reading is requested, to line up other instruments, a scope or
+// the meter's own external trigger input with this node's samples
+class TriggerOutput {
+ public:
+  TriggerOutput(GPIOPin *pin, uint32_t pulse_us) : pin_(pin), pulse_us_(pulse_us) {}
+
+  void setup() {
+    this->pin_->setup();
+    this->pin_->digital_write(false);
+  }
+
+  // Busy-waits for the pulse length, which is capped at 1 ms by the configuration
+  void pulse() {
+    this->pin_->digital_write(true);
+    delayMicroseconds(this->pulse_us_);
+    this->pin_->digital_write(false);
+  }
+
+ protected:
+  GPIOPin *pin_;
+  uint32_t pulse_us_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "sample_pipeline.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace esphome {
+namespace scpi_dmm {
+
+static const uint32_t WARM_STATE_VERSION = 2;
+
+// What the component knew about the meter before a reboot, kept so an OTA update or
+// crash does not cost a *RST and the user's settings. Only reused when the same meter
+// (idn_hash) answers and the same command set (profile_hash) is in use.
+struct WarmState {
+  uint32_t version;
+  uint32_t idn_hash;
+  uint32_t profile_hash;
+  uint32_t baud_rate;  // link rate last in use, 0 unless negotiated or detected
+  uint8_t function;  // MeasurementFunction
+  int8_t auto_range;
+  int8_t dual;
+  char range[16];
+  char rate[4];
+  uint16_t learned_settle_ms[FUNCTION_COUNT];
+};
+
+// Copies value into a fixed field, truncating and always terminating it
+template<size_t N> void warm_state_copy(char (&field)[N], const std::string &value) {
+  size_t length = std::min(value.size(), N - 1);
+  memcpy(field, value.data(), length);
+  field[length] = '\0';
+}
+
+template<size_t N> std::string warm_state_read(const char (&field)[N]) { return std::string(field, strnlen(field, N)); }
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace esphome {
+namespace scpi_dmm {
+
+enum class LinkState : uint8_t {
+  ONLINE,    // queries are answered
+  DEGRADED,  // recent queries timed out, still polling
+  OFFLINE,   // gave up; background polling suspended until a probe is answered
+  PROBING    // a probe is in flight
+};
+
+static const size_t LINK_STATE_COUNT = 4;
+
+inline const char *link_state_to_string(LinkState state) {
+  switch (state) {
+    case LinkState::ONLINE: return "online";
+    case LinkState::DEGRADED: return "degraded";
+    case LinkState::OFFLINE: return "offline";
+    case LinkState::PROBING: return "probing";
+  }
+  return "unknown";
+}
+
+// Liveness of the meter, fed with the outcome of every query. After offline_after
+// timeouts in a row the link is offline and probed at an exponential backoff from
+// probe_min_ms up to probe_max_ms; any answer brings it straight back online.
+class LinkWatchdog {
+ public:
+  void set_offline_after(uint8_t timeouts) { this->offline_after_ = std::max<uint8_t>(timeouts, 1); }
+  void set_probe_interval(uint32_t min_ms, uint32_t max_ms) {
+    this->probe_min_ms_ = min_ms;
+    this->probe_max_ms_ = std::max(min_ms, max_ms);
+    this->backoff_ms_ = min_ms;
+  }
+
+  // Returns true when the state changed
+  bool on_query(bool answered, uint32_t now) {
+    LinkState previous = this->state_;
+    if (answered) {
+      this->timeouts_ = 0;
+      this->backoff_ms_ = this->probe_min_ms_;
+      this->state_ = LinkState::ONLINE;
+    } else if (this->state_ == LinkState::PROBING) {
+      this->backoff_ms_ = std::min(this->backoff_ms_ * 2, this->probe_max_ms_);
+      this->go_offline_(now);
+    } else if (this->state_ != LinkState::OFFLINE) {
+      this->timeouts_++;
+      if (this->timeouts_ >= this->offline_after_) {
+        this->go_offline_(now);
+      } else {
+        this->state_ = LinkState::DEGRADED;
+      }
+    }
+    return this->state_ != previous;
+  }
+
+  bool probe_due(uint32_t now) const {
+    return this->state_ == LinkState::OFFLINE && now - this->offline_since_ >= this->backoff_ms_;
+  }
+  void on_probe_sent() { this->state_ = LinkState::PROBING; }
+
+  LinkState get_state() const { return this->state_; }
+  // Background polling is pointless while the meter does not answer
+  bool is_suspended() const { return this->state_ == LinkState::OFFLINE || this->state_ == LinkState::PROBING; }
+  uint32_t get_backoff_ms() const { return this->backoff_ms_; }
+
+ protected:
+  void go_offline_(uint32_t now) {
+    this->state_ = LinkState::OFFLINE;
+    this->offline_since_ = now;
+  }
+
+  LinkState state_{LinkState::ONLINE};
+  uint8_t offline_after_{3};
+  uint8_t timeouts_{0};
+  uint32_t probe_min_ms_{250};
+  uint32_t probe_max_ms_{30000};
+  uint32_t backoff_ms_{250};
+  uint32_t offline_since_{0};
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
@@ -0,0 +1,50 @@
+#pragma once
+
+#ifdef USE_SCPI_DMM_HTTP
+
+#include "esphome/components/web_server_base/web_server_base.h"
+
+#include <string>
+
+namespace esphome {
+namespace scpi_dmm {
+
+class SCPIDMM;
+
+// HTTP endpoints of the SCPIDMM component, served through web_server_base.
+// Requests arrive on the web server task, so handlers only touch thread-safe state.
+class SCPIDMMWebHandler : public AsyncWebHandler {
+ public:
+  // prefix is prepended to every route, so several meters can share one web server
+  SCPIDMMWebHandler(SCPIDMM *parent, std::string prefix) : parent_(parent), prefix_(std::move(prefix)) {}
+
+  bool canHandle(AsyncWebServerRequest *request) const override;
+  void handleRequest(AsyncWebServerRequest *request) override;
+
+ protected:
+  // GET /history?from=<ms>&to=<ms>[&bucket=<ms>][&limit=<n>]
+  // Times are uptime in ms; negative values are relative to now.
+  void handle_history_(AsyncWebServerRequest *request);
+#ifdef USE_SCPI_DMM_LIVE_STREAM
+  // GET /stream, Server-Sent Events of live readings (see LiveStream). Chunked
+  // responses are only available with the Arduino AsyncWebServer.
+  void handle_stream_(AsyncWebServerRequest *request);
+#endif
+  // GET /metrics, Prometheus text exposition format
+  void handle_metrics_(AsyncWebServerRequest *request);
+#ifdef USE_SCPI_DMM_DATALOG
+  // GET /log[?rotated=1], raw datalog file download (see FlashLogger)
+  void handle_log_(AsyncWebServerRequest *request);
+#endif
+
+  // The route below prefix_, empty if the URL is not ours
+  std::string route_(AsyncWebServerRequest *request) const;
+
+  SCPIDMM *parent_;
+  std::string prefix_;
+};
+
+}  // namespace scpi_dmm
+}  // namespace esphome
+
+#endif  // USE_SCPI_DMM_HTTP
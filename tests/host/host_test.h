@@ -0,0 +1,45 @@
+#pragma once
+
+// Minimal self-registering test harness, so the host tests need nothing but a compiler
+
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+namespace host_test {
+
+struct TestCase {
+  const char *name;
+  void (*run)();
+};
+
+inline std::vector<TestCase> &registry() {
+  static std::vector<TestCase> tests;
+  return tests;
+}
+
+inline int &failures() {
+  static int count = 0;
+  return count;
+}
+
+struct Registrar {
+  Registrar(const char *name, void (*run)()) { registry().push_back({name, run}); }
+};
+
+}  // namespace host_test
+
+#define TEST(name) \
+  static void name(); \
+  static host_test::Registrar name##_registrar(#name, &name); \
+  static void name()
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      host_test::failures()++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
@@ -0,0 +1,11 @@
+#include "host_test.h"
+
+int main() {
+  for (const host_test::TestCase &test : host_test::registry()) {
+    int before = host_test::failures();
+    test.run();
+    std::printf("%s %s\n", host_test::failures() == before ? "PASS" : "FAIL", test.name);
+  }
+  std::printf("%zu tests, %d failed checks\n", host_test::registry().size(), host_test::failures());
+  return host_test::failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// Host stand-in for esphome/components/uart/uart.h; only what the headers under test touch
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace uart {
+
+class UARTComponent {
+ public:
+  void flush() {}
+  void set_baud_rate(uint32_t baud_rate) { this->baud_rate_ = baud_rate; }
+  uint32_t get_baud_rate() const { return this->baud_rate_; }
+  void load_settings(bool /*dump_config*/) {}
+
+ protected:
+  uint32_t baud_rate_{9600};
+};
+
+class UARTDevice {
+ public:
+  int available() { return 0; }
+  bool read_array(uint8_t * /*data*/, size_t /*len*/) { return false; }
+};
+
+}  // namespace uart
+}  // namespace esphome
@@ -0,0 +1,36 @@
+#pragma once
+
+// Host stand-in for the parts of esphome/core/helpers.h the component headers use
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace esphome {
+
+template<typename T> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) { this->callbacks_.push_back(std::move(callback)); }
+  void call(Ts... args) {
+    for (auto &callback : this->callbacks_)
+      callback(args...);
+  }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+
+// Tests are single-threaded
+class Mutex {
+ public:
+  void lock() {}
+  void unlock() {}
+};
+
+class LockGuard {
+ public:
+  explicit LockGuard(Mutex & /*mutex*/) {}
+};
+
+}  // namespace esphome
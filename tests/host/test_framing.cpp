@@ -0,0 +1,107 @@
+#include "host_test.h"
+#include "response_framer.h"
+#include "rx_source.h"
+
+#include <string>
+#include <vector>
+
+using namespace esphome::scpi_dmm;
+
+namespace {
+
+// Pulls everything the source has through the framer, chunk bytes per read like the loop
+std::vector<std::string> frame_all(RxSource &source, ResponseFramer &framer, size_t chunk) {
+  std::vector<std::string> replies;
+  uint8_t buffer[64];
+  while (source.ready()) {
+    size_t count = source.read(buffer, std::min(chunk, sizeof(buffer)));
+    for (size_t i = 0; i < count; i++) {
+      if (framer.feed(buffer[i])) {
+        replies.push_back(framer.get());
+        framer.clear();
+      }
+    }
+  }
+  return replies;
+}
+
+}  // namespace
+
+TEST(framer_splits_lines) {
+  BufferRxSource source;
+  ResponseFramer framer;
+  source.feed("1.2345E+00\r\nVOLT\n\n");
+  source.feed("RANGE 2V\n");
+  std::vector<std::string> replies = frame_all(source, framer, 3);
+  CHECK_EQ(replies.size(), 3u);
+  CHECK_EQ(replies[0], "1.2345E+00");
+  CHECK_EQ(replies[1], "VOLT");
+  CHECK_EQ(replies[2], "RANGE 2V");
+  CHECK(!source.ready());
+}
+
+TEST(framer_reads_definite_length_block_with_lf) {
+  BufferRxSource source;
+  ResponseFramer framer;
+  source.feed(std::string("#18\x01\n\x02\x03\n\x04\x05\x06\n", 12));
+  source.feed("1.0\n");
+  std::vector<std::string> replies = frame_all(source, framer, 5);
+  CHECK_EQ(replies.size(), 2u);
+  CHECK_EQ(replies[0], std::string("\x01\n\x02\x03\n\x04\x05\x06", 8));
+  CHECK_EQ(replies[1], "1.0");
+}
+
+TEST(framer_falls_back_for_hash_text) {
+  BufferRxSource source;
+  ResponseFramer framer;
+  source.feed("#ERR 3\n");
+  std::vector<std::string> replies = frame_all(source, framer, 64);
+  CHECK_EQ(replies.size(), 1u);
+  CHECK_EQ(replies[0], "#ERR 3");
+}
+
+TEST(framer_truncates_long_reply) {
+  BufferRxSource source;
+  ResponseFramer framer(8);
+  source.feed("0123456789ABCDEF\nOK\n");
+  uint8_t buffer[64];
+  size_t count = source.read(buffer, sizeof(buffer));
+  std::vector<std::string> replies;
+  bool truncated = false;
+  for (size_t i = 0; i < count; i++) {
+    if (framer.feed(buffer[i])) {
+      replies.push_back(framer.get());
+      truncated |= framer.is_truncated();
+      framer.clear();
+    }
+  }
+  CHECK_EQ(replies.size(), 2u);
+  CHECK_EQ(replies[0], "01234567");
+  CHECK(truncated);
+  CHECK_EQ(replies[1], "OK");
+}
+
+TEST(pattern_matcher_finds_overlapping_pattern_across_reads) {
+  BufferRxSource source;
+  StreamPatternMatcher matcher;
+  matcher.set_pattern("ABAC");
+  source.feed("xxABAB");
+  source.feed("ACyyABAC");
+  int matches = 0;
+  uint8_t buffer[4];
+  while (source.ready()) {
+    size_t count = source.read(buffer, 2);
+    for (size_t i = 0; i < count; i++)
+      matches += matcher.feed(buffer[i]) ? 1 : 0;
+  }
+  CHECK_EQ(matches, 2);
+}
+
+TEST(pattern_matcher_empty_pattern_never_matches) {
+  StreamPatternMatcher matcher;
+  matcher.set_pattern("");
+  bool matched = false;
+  for (char c : std::string("anything"))
+    matched |= matcher.feed(c);
+  CHECK(!matched);
+}
@@ -0,0 +1,132 @@
+#include "baud_rate.h"
+#include "command_scheduler.h"
+#include "device_detect.h"
+#include "host_test.h"
+#include "watchdog.h"
+
+#include <string>
+#include <vector>
+
+using namespace esphome::scpi_dmm;
+
+TEST(watchdog_goes_offline_and_backs_off) {
+  LinkWatchdog watchdog;
+  watchdog.set_offline_after(3);
+  watchdog.set_probe_interval(250, 1000);
+  CHECK(watchdog.on_query(false, 0));
+  CHECK(watchdog.get_state() == LinkState::DEGRADED);
+  CHECK(!watchdog.on_query(false, 10));
+  CHECK(watchdog.on_query(false, 20));
+  CHECK(watchdog.get_state() == LinkState::OFFLINE);
+  CHECK(watchdog.is_suspended());
+
+  CHECK(!watchdog.probe_due(269));
+  CHECK(watchdog.probe_due(270));
+  watchdog.on_probe_sent();
+  CHECK(watchdog.get_state() == LinkState::PROBING);
+  watchdog.on_query(false, 300);
+  CHECK_EQ(watchdog.get_backoff_ms(), 500u);
+  watchdog.on_probe_sent();
+  watchdog.on_query(false, 800);
+  watchdog.on_probe_sent();
+  watchdog.on_query(false, 1800);
+  CHECK_EQ(watchdog.get_backoff_ms(), 1000u);
+
+  watchdog.on_probe_sent();
+  CHECK(watchdog.on_query(true, 2800));
+  CHECK(watchdog.get_state() == LinkState::ONLINE);
+  CHECK_EQ(watchdog.get_backoff_ms(), 250u);
+}
+
+TEST(watchdog_answer_resets_timeout_count) {
+  LinkWatchdog watchdog;
+  watchdog.set_offline_after(2);
+  watchdog.on_query(false, 0);
+  watchdog.on_query(true, 10);
+  watchdog.on_query(false, 20);
+  CHECK(watchdog.get_state() == LinkState::DEGRADED);
+}
+
+TEST(baud_rates_sorted_fastest_first) {
+  BaudRates rates;
+  rates.set({9600, 115200, 9600, 19200});
+  CHECK_EQ(rates.size(), 3u);
+  CHECK_EQ(rates.next_after(115200), 19200u);
+  CHECK_EQ(rates.next_after(9600), 115200u);
+  CHECK_EQ(rates.next_after(4800), 115200u);
+  CHECK_EQ(rates.faster_than(9600), 115200u);
+  rates.mark_failed(115200);
+  CHECK_EQ(rates.faster_than(9600), 19200u);
+  CHECK_EQ(rates.faster_than(19200), 0u);
+}
+
+TEST(apply_baud_rate_updates_uart) {
+  esphome::uart::UARTComponent uart;
+  apply_uart_baud_rate(&uart, 115200);
+  CHECK_EQ(uart.get_baud_rate(), 115200u);
+}
+
+TEST(idn_rules_pick_profile) {
+  CHECK_EQ(std::string(detect_profile("OWON,XDM1041,2205123,V3.6.0,3")), "OWON_XDM");
+  CHECK_EQ(std::string(detect_profile("owon,xdm2041,1,V1")), "OWON_XDM");
+  CHECK_EQ(std::string(detect_profile("Keysight Technologies,34460A,MY123,A.02.14")), "KEYSIGHT_34460A");
+  CHECK_EQ(std::string(detect_profile("Agilent Technologies,34460A,MY123,A.01")), "KEYSIGHT_34460A");
+  CHECK_EQ(std::string(detect_profile("Keysight Technologies,34465A,MY1,A.03")), GENERIC_PROFILE);
+  CHECK_EQ(std::string(detect_profile("garbage")), GENERIC_PROFILE);
+  CHECK_EQ(idn_field("OWON,XDM1041,2205123,V3.6.0", 3), "V3.6.0");
+  CHECK_EQ(idn_field("OWON,XDM1041", 3), "");
+}
+
+TEST(idn_plausibility) {
+  CHECK(idn_plausible("OWON,XDM1041,2205123,V3.6.0"));
+  CHECK(!idn_plausible("OWON,XDM1041"));
+  CHECK(!idn_plausible(std::string("\xfe,\x80,a,b", 8)));
+}
+
+// Mirrors SCPIDMM: query outcomes feed the watchdog through the completion hook, and a
+// meter power-up drops the query in flight before marking the link alive
+TEST(power_up_drops_query_without_timeout) {
+  LinkWatchdog watchdog;
+  watchdog.set_offline_after(3);
+  std::vector<LinkState> published;
+  int timeouts = 0;
+  QueryInFlight query;
+  query.set_on_complete([&](bool answered, uint32_t) {
+    timeouts += answered ? 0 : 1;
+    if (watchdog.on_query(answered, 0))
+      published.push_back(watchdog.get_state());
+  });
+  int callbacks = 0;
+
+  // One poll timed out before the power cycle
+  query.start(ResponseKind::MEASUREMENT, [&](bool, const std::string &) { callbacks++; }, 0);
+  query.finish(false, 500);
+  CHECK(watchdog.get_state() == LinkState::DEGRADED);
+
+  // The next poll is in flight when the power-up bytes arrive
+  query.start(ResponseKind::MEASUREMENT, [&](bool, const std::string &) { callbacks++; }, 600);
+  query.drop();
+  if (watchdog.on_query(true, 650))
+    published.push_back(watchdog.get_state());
+
+  CHECK(!query.pending());
+  CHECK_EQ(timeouts, 1);
+  CHECK_EQ(callbacks, 0);
+  CHECK_EQ(published.size(), 2u);
+  CHECK(published.back() == LinkState::ONLINE);
+  CHECK(watchdog.get_state() == LinkState::ONLINE);
+}
+
+TEST(query_reports_once_with_elapsed_time) {
+  QueryInFlight query;
+  std::vector<uint32_t> reports;
+  query.set_on_complete([&](bool, uint32_t elapsed_ms) { reports.push_back(elapsed_ms); });
+  query.start(ResponseKind::RAW, [](bool, const std::string &) {}, 100);
+  CHECK(query.pending());
+  ResponseCallback callback = query.finish(true, 142);
+  CHECK(callback != nullptr);
+  CHECK(!query.pending());
+  CHECK_EQ(query.sent_at(), 100u);
+  CHECK_EQ(reports.size(), 1u);
+  CHECK_EQ(reports[0], 42u);
+}
@@ -0,0 +1,86 @@
+#include "host_test.h"
+#include "sample_codec.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace esphome::scpi_dmm;
+
+namespace {
+
+std::vector<Sample> decode(const SampleBlock &block) {
+  std::vector<Sample> samples;
+  decode_sample_block(block, [&](const Sample &sample) {
+    samples.push_back(sample);
+    return true;
+  });
+  return samples;
+}
+
+bool same(const Sample &a, const Sample &b) {
+  return a.timestamp_ms == b.timestamp_ms && std::memcmp(&a.value, &b.value, sizeof(float)) == 0 &&
+         a.function == b.function && a.source == b.source;
+}
+
+}  // namespace
+
+TEST(codec_round_trips_irregular_samples) {
+  std::vector<Sample> in;
+  uint32_t t = 1000;
+  for (int i = 0; i < 100; i++) {
+    // Regular spacing with jitter, an occasional long gap and a repeated value
+    t += 20 + (i % 7 == 0 ? 3 : 0) + (i == 50 ? 70000 : 0);
+    float value = i % 11 == 0 ? 1.25f : 1.25f + 0.001f * (i % 5) - (i == 75 ? 1000.0f : 0.0f);
+    in.push_back(Sample{t, value, MeasurementFunction::VOLTAGE_DC, 2});
+  }
+  SampleBlock block;
+  SampleBlockEncoder encoder;
+  encoder.start(block, in[0]);
+  for (size_t i = 1; i < in.size(); i++)
+    CHECK(encoder.append(block, in[i]));
+  std::vector<Sample> out = decode(block);
+  CHECK_EQ(out.size(), in.size());
+  for (size_t i = 0; i < std::min(in.size(), out.size()); i++)
+    CHECK(same(in[i], out[i]));
+  // Far below the 12 bytes of a raw sample
+  CHECK(block.data_bytes() < in.size() * 6);
+}
+
+TEST(codec_keeps_nan_and_special_values) {
+  const float values[] = {NAN, INFINITY, -0.0f, 9.9e37f, 0.0f};
+  SampleBlock block;
+  SampleBlockEncoder encoder;
+  encoder.start(block, Sample{0, values[0], MeasurementFunction::RESISTANCE, 0});
+  for (size_t i = 1; i < 5; i++)
+    CHECK(encoder.append(block, Sample{uint32_t(i * 100), values[i], MeasurementFunction::RESISTANCE, 0}));
+  std::vector<Sample> out = decode(block);
+  CHECK_EQ(out.size(), 5u);
+  for (size_t i = 0; i < std::min<size_t>(out.size(), 5); i++)
+    CHECK(std::memcmp(&out[i].value, &values[i], sizeof(float)) == 0);
+}
+
+TEST(codec_refuses_samples_for_another_block) {
+  SampleBlock block;
+  SampleBlockEncoder encoder;
+  encoder.start(block, Sample{1000, 1.0f, MeasurementFunction::VOLTAGE_DC, 0});
+  CHECK(!encoder.append(block, Sample{1020, 1.0f, MeasurementFunction::VOLTAGE_AC, 0}));
+  CHECK(!encoder.append(block, Sample{1020, 1.0f, MeasurementFunction::VOLTAGE_DC, 1}));
+  CHECK(!encoder.append(block, Sample{999, 1.0f, MeasurementFunction::VOLTAGE_DC, 0}));
+  CHECK_EQ(block.count, 1);
+}
+
+TEST(codec_closes_a_full_block) {
+  SampleBlock block;
+  SampleBlockEncoder encoder;
+  uint32_t t = 0;
+  float value = 1.0f;
+  encoder.start(block, Sample{t, value, MeasurementFunction::CURRENT_DC, 0});
+  size_t appended = 1;
+  // Random-looking values and spacing use the widest encodings
+  while (encoder.append(block, Sample{t += 5000 + appended * 37, value = value * -1.37f + 0.11f,
+                                      MeasurementFunction::CURRENT_DC, 0}))
+    appended++;
+  CHECK(block.data_bytes() <= SAMPLE_BLOCK_BYTES);
+  CHECK_EQ(decode(block).size(), appended);
+}
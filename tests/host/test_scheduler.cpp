@@ -0,0 +1,92 @@
+#include "command_scheduler.h"
+#include "host_test.h"
+
+#include <string>
+
+using namespace esphome::scpi_dmm;
+
+namespace {
+
+ScheduledCommand command(const char *text, CommandPriority priority) {
+  ScheduledCommand scheduled;
+  scheduled.text = text;
+  scheduled.priority = priority;
+  return scheduled;
+}
+
+}  // namespace
+
+TEST(scheduler_serves_classes_in_priority_order) {
+  CommandScheduler scheduler;
+  scheduler.enqueue(command("H", CommandPriority::HOUSEKEEPING), 0);
+  scheduler.enqueue(command("M", CommandPriority::MEASUREMENT), 0);
+  scheduler.enqueue(command("I", CommandPriority::INTERACTIVE), 0);
+  scheduler.enqueue(command("C", CommandPriority::CONFIGURATION), 0);
+  std::string order;
+  ScheduledCommand out;
+  while (scheduler.next(10, out))
+    order += out.text;
+  CHECK_EQ(order, "ICMH");
+  CHECK_EQ(scheduler.get_stats(CommandPriority::HOUSEKEEPING).max_wait_ms, 10u);
+}
+
+TEST(scheduler_token_bucket_limits_rate) {
+  CommandScheduler scheduler;
+  scheduler.set_max_queue(100);
+  scheduler.set_rate(CommandPriority::MEASUREMENT, 10.0f, 2.0f);
+  for (int i = 0; i < 50; i++)
+    scheduler.enqueue(command("M", CommandPriority::MEASUREMENT), 0);
+  // The burst goes at once, then one token per 100 ms
+  int sent = 0;
+  ScheduledCommand out;
+  for (uint32_t now = 0; now <= 1000; now += 10) {
+    while (scheduler.next(now, out))
+      sent++;
+  }
+  CHECK(sent >= 11 && sent <= 12);
+}
+
+TEST(scheduler_drops_when_queue_full) {
+  CommandScheduler scheduler;
+  scheduler.set_max_queue(2);
+  int refused = 0;
+  for (int i = 0; i < 3; i++) {
+    ScheduledCommand scheduled = command("M", CommandPriority::MEASUREMENT);
+    scheduled.callback = [&](bool ok, const std::string &) { refused += ok ? 0 : 1; };
+    scheduler.enqueue(std::move(scheduled), 0);
+  }
+  CHECK_EQ(refused, 1);
+  CHECK_EQ(scheduler.get_stats(CommandPriority::MEASUREMENT).dropped, 1u);
+}
+
+TEST(scheduler_min_share_prevents_starvation) {
+  CommandScheduler scheduler;
+  scheduler.set_max_queue(100);
+  scheduler.set_min_share(CommandPriority::HOUSEKEEPING, 4);
+  for (int i = 0; i < 3; i++)
+    scheduler.enqueue(command("H", CommandPriority::HOUSEKEEPING), 0);
+  std::string order;
+  ScheduledCommand out;
+  for (uint32_t now = 0; now < 15; now++) {
+    // The measurement class always has a query ready
+    if (!scheduler.has_pending(CommandPriority::MEASUREMENT))
+      scheduler.enqueue(command("M", CommandPriority::MEASUREMENT), now);
+    if (scheduler.next(now, out))
+      order += out.text;
+  }
+  CHECK_EQ(order, "MMMMHMMMMHMMMMH");
+}
+
+TEST(scheduler_min_share_yields_to_interactive) {
+  CommandScheduler scheduler;
+  scheduler.set_min_share(CommandPriority::HOUSEKEEPING, 1);
+  scheduler.enqueue(command("H", CommandPriority::HOUSEKEEPING), 0);
+  scheduler.enqueue(command("M", CommandPriority::MEASUREMENT), 0);
+  scheduler.enqueue(command("I", CommandPriority::INTERACTIVE), 0);
+  scheduler.enqueue(command("I", CommandPriority::INTERACTIVE), 0);
+  std::string order;
+  ScheduledCommand out;
+  while (scheduler.next(0, out))
+    order += out.text;
+  CHECK_EQ(order, "IIHM");
+}